@@ -3,125 +3,3344 @@
 #include <vector>
 #include <thread>   
 #include <chrono>   
+#include <mutex>
+#include <condition_variable>
 #include <stdexcept>
 #include <limits>   
 #include <algorithm>
+#include <string>
+#include <cstdint>
+#include <cmath>
+#include <numeric>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <array>
+#include <unordered_map>
+#include <fstream>
+#include <cerrno>
+#include <cstdio>
+#include <cctype>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
-// Глобальные генераторы случайных чисел (для эффективности)
-static random_device globadRd;
-static mt19937_64 globadGen(globadRd());
+// Счетный генератор Philox4x32-10 (Salmon и др., "Parallel random numbers:
+// as easy as 1, 2, 3"). Число - это шифр от пары (ключ, счетчик), а не шаг
+// общего состояния, поэтому любой поток может сразу получить свою часть
+// последовательности: ключ - зерно, старшие 64 бита счетчика - номер потока
+// (например, строки матрицы), младшие - позиция в нем. Результат зависит только
+// от зерна и номера потока, а не от того, сколько потоков заполняют данные.
+class Philox4x32 {
+public:
+    using result_type = uint64_t;
+    using Block = array<uint32_t, 4>;
 
-int randomNumGen(const int minVal, const int maxVal) {
-    uniform_int_distribution<int> dist(minVal, maxVal);
-    return dist(globadGen);
+    explicit Philox4x32(uint64_t seed, uint64_t stream = 0)
+        : key{(uint32_t)seed, (uint32_t)(seed >> 32)}, streamLo((uint32_t)stream), streamHi((uint32_t)(stream >> 32)) {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return numeric_limits<result_type>::max(); }
+
+    // Один блок - 128 бит, то есть два 64-битных числа
+    result_type operator()() {
+        if (used == 2) {
+            const Block b = block(position++);
+            buffered[0] = (uint64_t)b[1] << 32 | b[0];
+            buffered[1] = (uint64_t)b[3] << 32 | b[2];
+            used = 0;
+        }
+        return buffered[used++];
+    }
+
+    // Запись n чисел прямо в буфер: блоки не зависят друг от друга, и цикл
+    // без общего состояния компилятор разворачивает и векторизует
+    void generate(uint64_t* out, size_t n) {
+        while (n > 0 && used < 2) {
+            *out++ = buffered[used++];
+            --n;
+        }
+        const size_t blocks = n / 2;
+        for (size_t i = 0; i < blocks; ++i) {
+            const Block b = block(position + i);
+            out[2 * i] = (uint64_t)b[1] << 32 | b[0];
+            out[2 * i + 1] = (uint64_t)b[3] << 32 | b[2];
+        }
+        position += blocks;
+        if (n % 2) out[n - 1] = (*this)();
+    }
+
+    // Переход вперед на n чисел без их вычисления
+    void discard(uint64_t n) {
+        while (n > 0 && used < 2) {
+            ++used;
+            --n;
+        }
+        position += n / 2;
+        if (n % 2) (*this)();
+    }
+
+    // Блок с заданными ключом и счетчиком: 10 раундов умножения и XOR
+    static Block philox(Block ctr, array<uint32_t, 2> k) {
+        for (int round = 0; round < 10; ++round) {
+            const uint64_t p0 = (uint64_t)0xD2511F53u * ctr[0];
+            const uint64_t p1 = (uint64_t)0xCD9E8D57u * ctr[2];
+            ctr = {(uint32_t)(p1 >> 32) ^ ctr[1] ^ k[0], (uint32_t)p1, (uint32_t)(p0 >> 32) ^ ctr[3] ^ k[1], (uint32_t)p0};
+            k[0] += 0x9E3779B9u;
+            k[1] += 0xBB67AE85u;
+        }
+        return ctr;
+    }
+
+private:
+    Block block(uint64_t index) const {
+        return philox({(uint32_t)index, (uint32_t)(index >> 32), streamLo, streamHi}, key);
+    }
+
+    array<uint32_t, 2> key;
+    uint32_t streamLo, streamHi;
+    uint64_t position = 0;
+    uint64_t buffered[2] = {0, 0};
+    int used = 2;
+};
+
+// Зерно сеанса берется из random_device один раз; каждый вызов nextSessionSeed
+// дает новое зерно (SplitMix64 от номера вызова), безопасно из любого потока
+uint64_t nextSessionSeed() {
+    static const uint64_t base = (uint64_t)random_device{}() << 32 | random_device{}();
+    static atomic<uint64_t> calls{0};
+    uint64_t z = base + 0x9E3779B97F4A7C15ULL * ++calls;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+int defaultThreadCount() {
+    const unsigned hw = thread::hardware_concurrency();
+    return hw == 0 ? 1 : static_cast<int>(hw);
+}
+
+// Число потоков для работы из elements элементов: на поток не меньше 2^16,
+// иначе запуск потоков дороже самой работы
+int threadsForWork(size_t elements) {
+    constexpr size_t minElementsPerThread = 1 << 16;
+    return (int)max<size_t>(1, min<size_t>(defaultThreadCount(), elements / minElementsPerThread));
+}
+
+// Строки [0, rows) делятся на полосы по потокам, body(from, to) для первой
+// полосы выполняется в вызывающем потоке
+template <typename Body>
+void forEachRowBand(int rows, int threads, Body body) {
+    threads = max(1, min(threads, rows));
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t)
+        workers.emplace_back(body, (int)((long long)rows * t / threads), (int)((long long)rows * (t + 1) / threads));
+    body(0, (int)((long long)rows / threads));
+    for (thread& w : workers) w.join();
+}
+
+// Матрица в одном выровненном буфере: строки лежат подряд, шаг строки
+// (stride) округлен до 64 байт, поэтому каждая строка начинается с границы
+// кеш-линии. Одна аллокация на всю матрицу вместо одной на строку.
+template <typename T>
+class Matrix {
+public:
+    static constexpr size_t alignment = 64;
+
+    // Строка или ее часть с шагом step элементов - без копирования
+    class RowView {
+    public:
+        RowView(const T* data, int count, int step = 1) : ptr(data), count(count), step(step) {}
+
+        int size() const { return count; }
+        const T& operator[](int i) const { return ptr[(ptrdiff_t)i * step]; }
+        const T* data() const { return ptr; }
+        int stride() const { return step; }
+        // Каждый k-й элемент начиная с first: например, четные столбцы - every(2)
+        RowView every(int k, int first = 0) const {
+            return RowView(ptr + (ptrdiff_t)first * step, count > first ? (count - first + k - 1) / k : 0, step * k);
+        }
+
+    private:
+        const T* ptr;
+        int count;
+        int step;
+    };
+
+    Matrix(int rows, int cols) : rowCount(rows), colCount(cols) {
+        if (rows <= 0 || cols <= 0) throw invalid_argument("Количество строк и столбцов должно быть больше нуля");
+        const size_t perLine = alignment / sizeof(T);
+        rowStride = (size_t)(cols + perLine - 1) / perLine * perLine;
+        storage.reset(static_cast<T*>(::operator new[]((size_t)rows * rowStride * sizeof(T), align_val_t(alignment))));
+        memset(storage.get(), 0, (size_t)rows * rowStride * sizeof(T));
+    }
+
+    int rows() const { return rowCount; }
+    int cols() const { return colCount; }
+    size_t stride() const { return rowStride; }
+
+    T* row(int r) { return storage.get() + (size_t)r * rowStride; }
+    const T* row(int r) const { return storage.get() + (size_t)r * rowStride; }
+    RowView rowView(int r) const { return RowView(row(r), colCount); }
+    T& operator()(int r, int c) { return row(r)[c]; }
+    const T& operator()(int r, int c) const { return row(r)[c]; }
+
+private:
+    struct AlignedDelete {
+        void operator()(T* p) const { ::operator delete[](p, align_val_t(alignment)); }
+    };
+
+    int rowCount, colCount;
+    size_t rowStride = 0;
+    unique_ptr<T, AlignedDelete> storage;
+};
+
+// Генератор с пакетной записью generate(out, n) - например, Philox4x32
+template <typename Engine, typename = void>
+struct HasBulkGenerate : false_type {};
+template <typename Engine>
+struct HasBulkGenerate<Engine, void_t<decltype(declval<Engine&>().generate(declval<uint64_t*>(), size_t()))>> : true_type {};
+
+// Заполнение строки равномерными числами из [minVal, maxVal] пачками: каждое
+// 64-битное слово генератора дает два 32-битных числа, а диапазон получается
+// умножением со сдвигом (метод Лемира) без создания распределения на каждое
+// число. Редкие значения из "хвоста" отбрасываются, так что смещения нет.
+template <typename Engine>
+void fillUniformRow(int* out, int count, int minVal, int maxVal, Engine& engine) {
+    if (minVal > maxVal) throw invalid_argument("Нижняя граница больше верхней");
+    const uint64_t range = (uint64_t)((int64_t)maxVal - minVal) + 1;
+    if (range > numeric_limits<uint32_t>::max()) throw invalid_argument("Слишком широкий диапазон");
+    const uint32_t threshold = (uint32_t)((1ULL << 32) % range); // Сколько младших значений отбросить
+    constexpr int batch = 256;
+    uint64_t words[batch / 2];
+    for (int c = 0; c < count;) {
+        const int n = min(batch, count - c);
+        if constexpr (HasBulkGenerate<Engine>::value) engine.generate(words, (n + 1) / 2);
+        else for (int i = 0; i < (n + 1) / 2; ++i) words[i] = engine();
+        for (int i = 0; i < n; ++i) {
+            uint64_t product = (words[i / 2] >> (32 * (i & 1)) & 0xFFFFFFFFULL) * range;
+            while ((uint32_t)product < threshold) product = (uint64_t)(uint32_t)engine() * range;
+            out[c + i] = (int)(minVal + (int64_t)(product >> 32));
+        }
+        c += n;
+    }
+}
+
+template <typename Engine>
+void fillUniform(Matrix<int>& m, int minVal, int maxVal, Engine& engine) {
+    for (int r = 0; r < m.rows(); ++r) fillUniformRow(m.row(r), m.cols(), minVal, maxVal, engine);
+}
+
+// Каждая строка - свой поток Philox с номером строки, поэтому матрица
+// одинакова при любом числе потоков
+void fillUniformParallel(Matrix<int>& m, int minVal, int maxVal, uint64_t seed, int threads = 0) {
+    if (threads <= 0) threads = threadsForWork((size_t)m.rows() * m.cols());
+    forEachRowBand(m.rows(), threads, [&](int from, int to) {
+        for (int r = from; r < to; ++r) {
+            Philox4x32 engine(seed, (uint64_t)r);
+            fillUniformRow(m.row(r), m.cols(), minVal, maxVal, engine);
+        }
+    });
+}
+
+// Ядро для одной строки: сумма неотрицательных элементов четных столбцов,
+// сами элементы плотно пишутся в out. Возвращает их количество. За последним
+// записанным элементом в out должен быть запас в evenColumnSlack элементов:
+// векторное ядро пишет по 8 чисел сразу, даже если нужны не все.
+using EvenColumnKernel = size_t (*)(const int* row, int cols, int* out, long long& sum);
+constexpr size_t evenColumnSlack = 8;
+
+// Без ветвлений: элемент пишется всегда, а указатель сдвигается только для
+// неотрицательных, поэтому предсказатель переходов не ошибается на случайных знаках
+size_t sumEvenColumnsScalar(const int* row, int cols, int* out, long long& sum) {
+    size_t n = 0;
+    long long s = 0;
+    for (int j = 0; j < cols; j += 2) {
+        const int v = row[j];
+        const bool keep = v >= 0;
+        out[n] = v;
+        n += keep;
+        s += keep ? v : 0;
+    }
+    sum += s;
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Для каждой 8-битной маски - перестановка, которая сдвигает выбранные
+// дорожки в начало регистра (аналог vpcompressd из AVX-512)
+struct CompressTable {
+    alignas(32) uint32_t lanes[256][8];
+};
+
+constexpr CompressTable makeCompressTable() {
+    CompressTable t{};
+    for (int mask = 0; mask < 256; ++mask) {
+        int n = 0;
+        for (int lane = 0; lane < 8; ++lane)
+            if (mask >> lane & 1) t.lanes[mask][n++] = lane;
+        for (; n < 8; ++n) t.lanes[mask][n] = 0;
+    }
+    return t;
+}
+
+static constexpr CompressTable compressTable = makeCompressTable();
+
+// 16 столбцов за итерацию: четные дорожки двух загрузок собираются в один
+// регистр, знак дает маску, сумма копится в 64-битных дорожках, а выбранные
+// значения сжимаются перестановкой по таблице и пишутся одной записью
+__attribute__((target("avx2")))
+size_t sumEvenColumnsAVX2(const int* row, int cols, int* out, long long& sum) {
+    const __m256i evenFirst = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    const __m256i minusOne = _mm256_set1_epi32(-1);
+    __m256i acc = _mm256_setzero_si256();
+    size_t n = 0;
+    int j = 0;
+    for (; j + 16 <= cols; j += 16) {
+        const __m256i lo = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(row + j)), evenFirst);
+        const __m256i hi = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(row + j + 8)), evenFirst);
+        const __m256i v = _mm256_permute2x128_si256(lo, hi, 0x20);
+        const __m256i keep = _mm256_cmpgt_epi32(v, minusOne);
+        const __m256i kept = _mm256_and_si256(v, keep);
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(kept)));
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(kept, 1)));
+        const unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(keep));
+        const __m256i order = _mm256_load_si256((const __m256i*)compressTable.lanes[mask]);
+        _mm256_storeu_si256((__m256i*)(out + n), _mm256_permutevar8x32_epi32(v, order));
+        n += __builtin_popcount(mask);
+    }
+    alignas(32) long long lanes[4];
+    _mm256_store_si256((__m256i*)lanes, acc);
+    sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    // j кратно 16, поэтому хвост тоже начинается с четного столбца
+    return n + sumEvenColumnsScalar(row + j, cols - j, out + n, sum);
+}
+#endif
+
+EvenColumnKernel activeEvenColumnKernel() {
+    static const EvenColumnKernel kernel = []() -> EvenColumnKernel {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return sumEvenColumnsAVX2;
+#endif
+        return sumEvenColumnsScalar;
+    }();
+    return kernel;
+}
+
+// Сумма неотрицательных элементов на пересечении нечетных строк и четных
+// столбцов; сами элементы по порядку записываются в selected. Выход заранее
+// размечен под худший случай и в конце обрезается - без push_back.
+long long sumOddRowsEvenCols(const Matrix<int>& m, vector<int>& selected, EvenColumnKernel kernel = activeEvenColumnKernel()) {
+    const size_t perRow = (size_t)(m.cols() + 1) / 2;
+    selected.resize((size_t)(m.rows() / 2) * perRow + evenColumnSlack);
+    long long sum = 0;
+    size_t n = 0;
+    for (int i = 1; i < m.rows(); i += 2) // Нечетные строки
+        n += kernel(m.row(i), m.cols(), selected.data() + n, sum);
+    selected.resize(n);
+    return sum;
+}
+
+// То же по потокам: нечетные строки делятся на полосы, каждая пишет в свой
+// участок выхода (с запасом под векторную запись), затем участки по порядку
+// сдвигаются вплотную друг к другу, а частичные суммы складываются.
+long long sumOddRowsEvenColsParallel(const Matrix<int>& m, vector<int>& selected, int threads = 0,
+                                     EvenColumnKernel kernel = activeEvenColumnKernel()) {
+    const int oddRows = m.rows() / 2;
+    const size_t perRow = (size_t)(m.cols() + 1) / 2;
+    // Без явного числа потоков малые матрицы считаются в одном потоке
+    if (threads <= 0) threads = threadsForWork((size_t)oddRows * perRow);
+    threads = max(1, min(threads, oddRows));
+    if (threads == 1) return sumOddRowsEvenCols(m, selected, kernel);
+
+    vector<int> firstRow(threads + 1);
+    for (int t = 0; t <= threads; ++t) firstRow[t] = (int)((long long)oddRows * t / threads);
+    auto segmentStart = [&](int t) { return firstRow[t] * perRow + t * evenColumnSlack; };
+    selected.resize(segmentStart(threads));
+    vector<size_t> counts(threads);
+    vector<long long> sums(threads);
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&, t] {
+            int* out = selected.data() + segmentStart(t);
+            size_t n = 0;
+            long long sum = 0;
+            for (int k = firstRow[t]; k < firstRow[t + 1]; ++k)
+                n += kernel(m.row(2 * k + 1), m.cols(), out + n, sum);
+            counts[t] = n;
+            sums[t] = sum;
+        });
+    for (thread& w : workers) w.join();
+
+    size_t n = counts[0];
+    for (int t = 1; t < threads; ++t) {
+        memmove(selected.data() + n, selected.data() + segmentStart(t), counts[t] * sizeof(int));
+        n += counts[t];
+    }
+    selected.resize(n);
+    return accumulate(sums.begin(), sums.end(), 0LL);
+}
+
+using RowSumKernel = long long (*)(const int* row, int cols);
+
+long long rowSumScalar(const int* row, int cols) {
+    return accumulate(row, row + cols, 0LL);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Два 64-битных аккумулятора по 4 дорожки: 32-битные числа расширяются перед
+// сложением, поэтому длинная строка не переполняется; горизонтальная сумма -
+// один раз в конце строки
+__attribute__((target("avx2")))
+long long rowSumAVX2(const int* row, int cols) {
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    int j = 0;
+    for (; j + 8 <= cols; j += 8) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(row + j));
+        acc0 = _mm256_add_epi64(acc0, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v)));
+        acc1 = _mm256_add_epi64(acc1, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1)));
+    }
+    const __m256i acc = _mm256_add_epi64(acc0, acc1);
+    const __m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    return _mm_cvtsi128_si64(_mm_add_epi64(half, _mm_unpackhi_epi64(half, half))) + rowSumScalar(row + j, cols - j);
+}
+#endif
+
+RowSumKernel activeRowSumKernel() {
+    static const RowSumKernel kernel = []() -> RowSumKernel {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return rowSumAVX2;
+#endif
+        return rowSumScalar;
+    }();
+    return kernel;
+}
+
+// Суммы строк; строки делятся на полосы по потокам, каждый пишет в свою часть
+// результата, поэтому синхронизация нужна только на join
+vector<long long> matrixRowSums(const Matrix<int>& m, int threads = 0, RowSumKernel kernel = activeRowSumKernel()) {
+    if (threads <= 0) threads = threadsForWork((size_t)m.rows() * m.cols());
+    vector<long long> sums(m.rows());
+    forEachRowBand(m.rows(), threads, [&](int from, int to) {
+        for (int i = from; i < to; ++i) sums[i] = kernel(m.row(i), m.cols());
+    });
+    return sums;
+}
+
+// Индекс строки с k-й по величине различной суммой (k = 1 - максимум) или -1,
+// если различных сумм меньше k. Один проход без сортировки: держим не более k
+// лучших различных сумм по убыванию, каждая с первой строкой, где она
+// встретилась, так что при равных суммах выбирается строка с меньшим индексом.
+template <typename S>
+int kthLargestDistinctRow(const vector<S>& sums, int k) {
+    if (k <= 0) throw invalid_argument("k должно быть положительным");
+    vector<pair<S, int>> top; // (сумма, строка), по убыванию сумм
+    top.reserve(k + 1);
+    for (int i = 0; i < (int)sums.size(); ++i) {
+        const S s = sums[i];
+        if ((int)top.size() == k && s <= top.back().first) continue; // Частый случай - одно сравнение
+        auto pos = lower_bound(top.begin(), top.end(), s, [](const pair<S, int>& e, S v) { return e.first > v; });
+        if (pos != top.end() && pos->first == s) continue; // Такая сумма уже есть, строка раньше
+        top.insert(pos, {s, i});
+        if ((int)top.size() > k) top.pop_back();
+    }
+    return (int)top.size() == k ? top.back().second : -1;
+}
+
+// Матрица в двоичном файле: 64-байтный заголовок, затем строки подряд без
+// выравнивания, числа в порядке байт машины (little-endian на x86). Файл может
+// быть больше памяти - он отображается через mmap и читается за один проход.
+enum class MatrixElementType : uint32_t { Int32 = 1, Int64 = 2, Float64 = 3 };
+
+struct MatrixFileHeader {
+    char magic[8];
+    uint32_t version;
+    MatrixElementType type;
+    uint64_t rows, cols;
+    uint8_t reserved[32];
+};
+static_assert(sizeof(MatrixFileHeader) == 64, "заголовок матрицы должен занимать 64 байта");
+
+constexpr char matrixFileMagic[8] = {'N', 'S', 'T', 'U', 'M', 'T', 'X', '\0'};
+
+size_t matrixElementSize(MatrixElementType type) {
+    switch (type) {
+    case MatrixElementType::Int32: return 4;
+    case MatrixElementType::Int64: return 8;
+    case MatrixElementType::Float64: return 8;
+    }
+    throw runtime_error("Неизвестный тип элементов матрицы");
+}
+
+MatrixElementType parseMatrixElementType(const string& name) {
+    if (name == "int32") return MatrixElementType::Int32;
+    if (name == "int64") return MatrixElementType::Int64;
+    if (name == "double") return MatrixElementType::Float64;
+    throw invalid_argument("Тип элементов должен быть int32, int64 или double: " + name);
+}
+
+// Файл, отображенный в память только для чтения
+class MappedFile {
+public:
+    explicit MappedFile(const string& path) {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw runtime_error("Не удалось открыть файл " + path + ": " + strerror(errno));
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error("Не удалось узнать размер файла " + path);
+        }
+        length = (size_t)st.st_size;
+        if (length > 0) {
+            void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            close(fd); // Отображение держит файл само
+            if (p == MAP_FAILED) throw runtime_error("Не удалось отобразить файл " + path + ": " + strerror(errno));
+            base = static_cast<const uint8_t*>(p);
+            madvise(const_cast<uint8_t*>(base), length, MADV_SEQUENTIAL);
+        } else {
+            close(fd);
+        }
+    }
+    ~MappedFile() {
+        if (base) munmap(const_cast<uint8_t*>(base), length);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+
+    // Прочитанные страницы больше не нужны: ядро может сразу отдать их под
+    // другое, и резидентная память не растет вместе с файлом
+    void release(size_t from, size_t to) const {
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        from = from / page * page;
+        to = to / page * page;
+        if (base && to > from) madvise(const_cast<uint8_t*>(base) + from, to - from, MADV_DONTNEED);
+    }
+
+private:
+    const uint8_t* base = nullptr;
+    size_t length = 0;
+};
+
+MatrixFileHeader readMatrixFileHeader(const MappedFile& file) {
+    MatrixFileHeader header;
+    if (file.size() < sizeof header) throw runtime_error("Файл слишком мал для заголовка матрицы");
+    memcpy(&header, file.data(), sizeof header);
+    if (memcmp(header.magic, matrixFileMagic, sizeof matrixFileMagic) != 0) throw runtime_error("Файл не является матрицей");
+    if (header.version != 1) throw runtime_error("Неподдерживаемая версия файла матрицы: " + to_string(header.version));
+    const size_t elementSize = matrixElementSize(header.type);
+    if (header.rows == 0 || header.cols == 0 || header.cols > (uint64_t)numeric_limits<int>::max())
+        throw runtime_error("Неверные размеры матрицы в заголовке");
+    if ((file.size() - sizeof header) / elementSize / header.cols < header.rows)
+        throw runtime_error("Файл короче, чем указано в заголовке");
+    return header;
+}
+
+// Целые суммируются в long long, вещественные - в double
+template <typename T>
+using MatrixSum = conditional_t<is_floating_point<T>::value, double, long long>;
+
+// Все, что остается после прохода по файлу: O(rows) памяти
+template <typename S>
+struct MatrixFileSummary {
+    uint64_t rows = 0, cols = 0;
+    vector<S> rowSums;
+    S filteredSum = 0;          // Неотрицательные элементы нечетных строк и четных столбцов
+    uint64_t filteredCount = 0;
+};
+
+// Один проход: сумма каждой строки и отфильтрованная сумма. Для int32
+// используются те же векторные ядра, что и для матрицы в памяти; строка
+// читается прямо из отображения, только отбор четных столбцов пишет в буфер
+// на полстроки. Пройденные страницы отпускаются каждые 64 МБ.
+template <typename T>
+MatrixFileSummary<MatrixSum<T>> analyzeMatrixFile(const MappedFile& file, const MatrixFileHeader& header) {
+    MatrixFileSummary<MatrixSum<T>> summary;
+    summary.rows = header.rows;
+    summary.cols = header.cols;
+    summary.rowSums.resize(header.rows);
+    const int cols = (int)header.cols;
+    const size_t rowBytes = (size_t)cols * sizeof(T);
+    constexpr size_t releaseEvery = 64u << 20;
+    vector<int> selected;
+    if (is_same<T, int32_t>::value) selected.resize((size_t)(cols + 1) / 2 + evenColumnSlack);
+    const RowSumKernel rowKernel = activeRowSumKernel();
+    const EvenColumnKernel evenKernel = activeEvenColumnKernel();
+    size_t released = 0;
+    for (uint64_t i = 0; i < header.rows; ++i) {
+        const size_t offset = sizeof(MatrixFileHeader) + i * rowBytes;
+        const uint8_t* bytes = file.data() + offset;
+        if constexpr (is_same<T, int32_t>::value) {
+            // Начало строки может быть не выровнено - ядра читают loadu
+            const int* row = reinterpret_cast<const int*>(bytes);
+            summary.rowSums[i] = rowKernel(row, cols);
+            if (i % 2 == 1) summary.filteredCount += evenKernel(row, cols, selected.data(), summary.filteredSum);
+        } else {
+            // Отображение начинается с границы страницы, заголовок - 64 байта,
+            // шаг элементов - sizeof(T), поэтому элемент всегда выровнен
+            static_assert(sizeof(MatrixFileHeader) % alignof(T) == 0, "заголовок нарушает выравнивание элементов");
+            const T* row = reinterpret_cast<const T*>(bytes);
+            MatrixSum<T> sum = 0;
+            for (int j = 0; j < cols; ++j) sum += row[j];
+            summary.rowSums[i] = sum;
+            if (i % 2 == 1) {
+                MatrixSum<T> filtered = 0;
+                uint64_t count = 0;
+                for (int j = 0; j < cols; j += 2) {
+                    const T v = row[j];
+                    const bool keep = v >= 0;
+                    filtered += keep ? v : 0;
+                    count += keep;
+                }
+                summary.filteredSum += filtered;
+                summary.filteredCount += count;
+            }
+        }
+        if (offset + rowBytes - released >= releaseEvery) {
+            file.release(released, offset + rowBytes);
+            released = offset + rowBytes;
+        }
+    }
+    return summary;
+}
+
+// Потоковая запись случайной матрицы: в памяти только одна строка, так что
+// можно получить файл больше ОЗУ. Вещественные элементы - целое из диапазона
+// плюс дробная часть.
+void writeMatrixFile(const string& path, uint64_t rows, uint64_t cols, MatrixElementType type,
+                     uint64_t seed, int minVal, int maxVal) {
+    if (rows == 0 || cols == 0 || cols > (uint64_t)numeric_limits<int>::max())
+        throw invalid_argument("Неверные размеры матрицы");
+    unique_ptr<FILE, decltype(&fclose)> file(fopen(path.c_str(), "wb"), fclose);
+    if (!file) throw runtime_error("Не удалось создать файл " + path);
+    MatrixFileHeader header = {};
+    memcpy(header.magic, matrixFileMagic, sizeof matrixFileMagic);
+    header.version = 1;
+    header.type = type;
+    header.rows = rows;
+    header.cols = cols;
+    const size_t elementSize = matrixElementSize(type);
+    fwrite(&header, sizeof header, 1, file.get());
+
+    Matrix<int> values(1, (int)cols);
+    vector<uint8_t> buffer(cols * elementSize);
+    for (uint64_t i = 0; i < rows; ++i) {
+        Philox4x32 gen(seed, i); // Строку можно получить заново без остальных
+        fillUniformRow(values.row(0), (int)cols, minVal, maxVal, gen);
+        const int* v = values.row(0);
+        for (uint64_t j = 0; j < cols; ++j) {
+            uint8_t* out = buffer.data() + j * elementSize;
+            if (type == MatrixElementType::Int32) {
+                memcpy(out, &v[j], 4);
+            } else if (type == MatrixElementType::Int64) {
+                const int64_t x = v[j];
+                memcpy(out, &x, 8);
+            } else {
+                const double x = v[j] + (double)(gen() >> 11) * 0x1.0p-53;
+                memcpy(out, &x, 8);
+            }
+        }
+        if (fwrite(buffer.data(), 1, buffer.size(), file.get()) != buffer.size())
+            throw runtime_error("Ошибка записи в файл " + path);
+    }
+    if (fflush(file.get()) != 0) throw runtime_error("Ошибка записи в файл " + path);
+}
+
+// Сверка матричных функций с наивной реализацией на vector<vector<int>>
+bool checkMatrixKernels(int matrices = 200) {
+    mt19937 gen(777);
+    int failures = 0;
+    for (int t = 0; t < matrices; ++t) {
+        const int rows = 1 + gen() % 40, cols = 1 + gen() % 70;
+        const int lo = -(int)(gen() % 100), hi = lo + (int)(gen() % 150);
+        Matrix<int> m(rows, cols);
+        fillUniform(m, lo, hi, gen);
+        vector<vector<int>> naive(rows, vector<int>(cols));
+        bool inRange = true;
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < cols; ++j) {
+                naive[i][j] = m(i, j);
+                inRange = inRange && m(i, j) >= lo && m(i, j) <= hi;
+            }
+        long long expectedSum = 0;
+        vector<int> expectedSelected;
+        for (int i = 1; i < rows; i += 2)
+            for (int j = 0; j < cols; j += 2)
+                if (naive[i][j] >= 0) {
+                    expectedSum += naive[i][j];
+                    expectedSelected.push_back(naive[i][j]);
+                }
+        bool sumsMatch = true;
+        vector<int> selected;
+        vector<EvenColumnKernel> kernels = {sumEvenColumnsScalar};
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx2")) kernels.push_back(sumEvenColumnsAVX2);
+#endif
+        for (EvenColumnKernel kernel : kernels) {
+            sumsMatch = sumsMatch && sumOddRowsEvenCols(m, selected, kernel) == expectedSum && selected == expectedSelected;
+            for (int threads = 2; threads <= 5; ++threads)
+                sumsMatch = sumsMatch && sumOddRowsEvenColsParallel(m, selected, threads, kernel) == expectedSum
+                    && selected == expectedSelected;
+        }
+        vector<long long> expectedRowSums(rows);
+        for (int i = 0; i < rows; ++i) expectedRowSums[i] = accumulate(naive[i].begin(), naive[i].end(), 0LL);
+        vector<RowSumKernel> rowKernels = {rowSumScalar};
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("avx2")) rowKernels.push_back(rowSumAVX2);
+#endif
+        for (RowSumKernel kernel : rowKernels)
+            for (int threads = 1; threads <= 3; ++threads)
+                sumsMatch = sumsMatch && matrixRowSums(m, threads, kernel) == expectedRowSums;
+
+        // k-я различная сумма против сортировки; суммы из узкого диапазона дают много равных
+        vector<long long> tied(rows);
+        for (int i = 0; i < rows; ++i) tied[i] = gen() % 6;
+        for (const vector<long long>* sums : {&expectedRowSums, &tied})
+            for (int k = 1; k <= 4; ++k) {
+                vector<pair<long long, int>> sorted;
+                for (int i = 0; i < rows; ++i) sorted.push_back({-(*sums)[i], i});
+                sort(sorted.begin(), sorted.end());
+                int expected = -1, distinct = 0;
+                for (size_t i = 0; i < sorted.size() && expected == -1; ++i)
+                    if ((i == 0 || sorted[i].first != sorted[i - 1].first) && ++distinct == k) expected = sorted[i].second;
+                sumsMatch = sumsMatch && kthLargestDistinctRow(*sums, k) == expected;
+            }
+
+        if (!inRange || !sumsMatch
+            || m.stride() % (64 / sizeof(int)) != 0 || (uintptr_t)m.row(rows - 1) % 64 != 0) {
+            cout << "Матрица: расхождение на " << rows << "x" << cols << " [" << lo << ", " << hi << "]" << endl;
+            ++failures;
+        }
+    }
+    // Файл матрицы каждого типа: проход по отображению против чтения fread
+    const string matrixPath = "matrix_check.bin";
+    for (MatrixElementType type : {MatrixElementType::Int32, MatrixElementType::Int64, MatrixElementType::Float64}) {
+        const uint64_t rows = 1 + gen() % 60, cols = 1 + gen() % 90;
+        writeMatrixFile(matrixPath, rows, cols, type, gen(), -50, 50);
+        vector<double> expectedSums(rows);
+        double expectedFiltered = 0;
+        uint64_t expectedCount = 0;
+        FILE* f = fopen(matrixPath.c_str(), "rb");
+        fseek(f, sizeof(MatrixFileHeader), SEEK_SET);
+        for (uint64_t i = 0; i < rows; ++i)
+            for (uint64_t j = 0; j < cols; ++j) {
+                double v = 0;
+                if (type == MatrixElementType::Int32) {
+                    int32_t x;
+                    v = fread(&x, sizeof x, 1, f) == 1 ? x : NAN;
+                } else if (type == MatrixElementType::Int64) {
+                    int64_t x;
+                    v = fread(&x, sizeof x, 1, f) == 1 ? (double)x : NAN;
+                } else if (fread(&v, sizeof v, 1, f) != 1) {
+                    v = NAN;
+                }
+                expectedSums[i] += v;
+                if (i % 2 == 1 && j % 2 == 0 && v >= 0) {
+                    expectedFiltered += v;
+                    ++expectedCount;
+                }
+            }
+        fclose(f);
+        const MappedFile file(matrixPath);
+        const MatrixFileHeader header = readMatrixFileHeader(file);
+        auto matches = [&](const auto& summary) {
+            bool same = summary.rows == rows && summary.cols == cols && summary.filteredCount == expectedCount
+                && fabs((double)summary.filteredSum - expectedFiltered) < 1e-6 * (1 + fabs(expectedFiltered));
+            for (uint64_t i = 0; i < rows; ++i)
+                same = same && fabs((double)summary.rowSums[i] - expectedSums[i]) < 1e-6 * (1 + fabs(expectedSums[i]));
+            return same;
+        };
+        bool same = header.type == type;
+        if (type == MatrixElementType::Int32) same = same && matches(analyzeMatrixFile<int32_t>(file, header));
+        else if (type == MatrixElementType::Int64) same = same && matches(analyzeMatrixFile<int64_t>(file, header));
+        else same = same && matches(analyzeMatrixFile<double>(file, header));
+        if (!same) {
+            cout << "Файл матрицы " << rows << "x" << cols << " типа " << (int)type << ": расхождение" << endl;
+            ++failures;
+        }
+    }
+    remove(matrixPath.c_str());
+
+    // Philox4x32-10: эталонные векторы из Random123, пакетная запись и переход
+    // вперед совпадают с поочередными вызовами, заполнение не зависит от потоков
+    const Philox4x32::Block kat[3][2] = {
+        {{0, 0, 0, 0}, {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+        {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+        {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}};
+    const array<uint32_t, 2> katKeys[3] = {{0, 0}, {0xffffffff, 0xffffffff}, {0xa4093822, 0x299f31d0}};
+    bool rngOk = true;
+    for (int i = 0; i < 3; ++i) rngOk = rngOk && Philox4x32::philox(kat[i][0], katKeys[i]) == kat[i][1];
+    for (int t = 0; t < 50; ++t) {
+        const uint64_t seed = gen(), stream = gen();
+        const size_t skip = gen() % 7, n = gen() % 40;
+        Philox4x32 single(seed, stream), bulk(seed, stream), jump(seed, stream);
+        vector<uint64_t> expected(skip + n), got(n);
+        for (uint64_t& x : expected) x = single();
+        for (size_t i = 0; i < skip; ++i) bulk();
+        bulk.generate(got.data(), n);
+        jump.discard(skip);
+        rngOk = rngOk && equal(got.begin(), got.end(), expected.begin() + skip) && (n == 0 || jump() == expected[skip]);
+    }
+    {
+        Matrix<int> one(37, 300), many(37, 300);
+        fillUniformParallel(one, -1000, 1000, 99, 1);
+        fillUniformParallel(many, -1000, 1000, 99, 7);
+        for (int i = 0; i < one.rows(); ++i) rngOk = rngOk && equal(one.row(i), one.row(i) + one.cols(), many.row(i));
+        rngOk = rngOk && !equal(one.row(0), one.row(0) + one.cols(), one.row(1)); // Потоки строк различаются
+    }
+    if (!rngOk) {
+        cout << "Генератор Philox: расхождение" << endl;
+        ++failures;
+    }
+
+    // Оба конца диапазона должны выпадать, иначе в отображении ошибка на единицу
+    Matrix<int> coverage(64, 64);
+    fillUniform(coverage, -50, 50, gen);
+    bool sawMin = false, sawMax = false;
+    for (int i = 0; i < coverage.rows(); ++i)
+        for (int j = 0; j < coverage.cols(); ++j) {
+            sawMin = sawMin || coverage(i, j) == -50;
+            sawMax = sawMax || coverage(i, j) == 50;
+        }
+    if (!sawMin || !sawMax) ++failures;
+    cout << "Матрица (выравнивание, заполнение, суммы, k-я сумма строки, файл через mmap, Philox): " << (failures == 0 ? "OK" : "ОШИБКА") << endl;
+    return failures == 0;
+}
+
+// Вывод кадров Игры 'Жизнь' в терминал. Кадр собирается в один заранее
+// выделенный буфер и уходит одним вызовом write. Вместо system("clear")
+// курсор ставится ANSI-последовательностями, и перерисовываются только
+// клетки, изменившиеся с прошлого кадра. Строка 1 - заголовок, поле с строки 2.
+class TerminalRenderer {
+public:
+    TerminalRenderer(int rows, int cols) : rows(rows), cols(cols), shown((size_t)rows * cols, 0) {
+        // Худший случай: каждая клетка со своим перемещением курсора
+        frame.reserve((size_t)rows * cols * 12 + 256);
+    }
+
+    void draw(const string& header, const vector<vector<char>>& grid) {
+        frame.clear();
+        if (first) frame += "\x1b[?25l\x1b[H\x1b[2J"; // Скрыть курсор и очистить экран один раз
+        frame += "\x1b[1;1H";
+        frame += header;
+        frame += "\x1b[K";
+        for (int i = 0; i < rows; ++i) {
+            const char* row = grid[i].data();
+            char* old = &shown[(size_t)i * cols];
+            int j = 0;
+            while (j < cols) {
+                if (!first && row[j] == old[j]) {
+                    ++j;
+                    continue;
+                }
+                // Короткие промежутки без изменений дешевле напечатать, чем
+                // переставлять курсор, поэтому отрезки склеиваются
+                moveCursor(i + 2, j + 1);
+                int end = j;
+                for (int gap = 0; end < cols && gap < maxGap; ++end) gap = (first || row[end] != old[end]) ? 0 : gap + 1;
+                while (end > j && !first && row[end - 1] == old[end - 1]) --end;
+                frame.append(row + j, end - j);
+                memcpy(old + j, row + j, end - j);
+                j = end;
+            }
+        }
+        first = false;
+        flush();
+    }
+
+    // Курсор под поле и снова видимый, чтобы дальнейший вывод шел после кадра
+    void finish() {
+        frame.clear();
+        moveCursor(rows + 2, 1);
+        frame += "\x1b[?25h";
+        flush();
+    }
+
+private:
+    static constexpr int maxGap = 8;
+
+    const int rows, cols;
+    vector<char> shown;  // Что сейчас на экране
+    string frame;
+    bool first = true;
+
+    void moveCursor(int row, int col) {
+        char buf[32];
+        const int n = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", row, col);
+        frame.append(buf, n);
+    }
+
+    void flush() {
+        cout.flush(); // Предыдущий вывод через iostream должен уйти раньше кадра
+        const char* data = frame.data();
+        size_t left = frame.size();
+        while (left > 0) {
+            const ssize_t written = ::write(STDOUT_FILENO, data, left);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw runtime_error("Не удалось вывести кадр");
+            }
+            data += written;
+            left -= written;
+        }
+    }
+};
+
+// Ограничение частоты кадров: ждем до дедлайна кадра, а не фиксированную
+// задержку, поэтому время счета поколения входит в период. Если счет отстал,
+// дедлайн сдвигается на текущее время, а не копит долг.
+class FrameLimiter {
+public:
+    explicit FrameLimiter(int periodMs) : period(periodMs), deadline(chrono::steady_clock::now()) {}
+
+    void wait() {
+        deadline += period;
+        const auto now = chrono::steady_clock::now();
+        if (deadline > now) this_thread::sleep_until(deadline);
+        else deadline = now;
+    }
+
+private:
+    chrono::milliseconds period;
+    chrono::steady_clock::time_point deadline;
+};
+
+int countLiveNeighbours(const vector<vector<char>>& grid, int r, int c, int rows, int cols) {
+    int count = 0;
+    for (int dr = -1; dr <= 1; ++dr) {
+        for (int dc = -1; dc <= 1; ++dc) {
+            if (dr == 0 && dc == 0) { // Пропускаем саму клетку
+                continue;
+            }
+            int nr = r + dr; // Соседняя строка
+            int nc = c + dc; // Соседний столбец
+
+            // Проверяем границы
+            if (nr >= 0 && nr < rows && nc >= 0 && nc < cols) {
+                if (grid[nr][nc] == '0') count++;
+            }
+        }
+    }
+    return count;
+}
+
+void calculateNextGeneration(vector<vector<char>>& grid, int rows, int cols) {
+    vector<vector<char>> nextGrid = grid; // Создаем копию текущего состояния для вычислений
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            int liveNeighbours = countLiveNeighbours(grid, i, j, rows, cols);
+            char currentCellState = grid[i][j];
+
+            if (currentCellState == '0') { // Если клетка жива
+                // Правила для живой клетки
+                if (liveNeighbours < 2 || liveNeighbours > 3) {
+                    nextGrid[i][j] = ' '; // Умирает от одиночества или перенаселения
+                }
+                // Если соседей 2 или 3, остается живой (ничего не меняем в nextGrid)
+            } else { // Если клетка мертва (' ')
+                // Правила для мертвой клетки
+                if (liveNeighbours == 3) nextGrid[i][j] = '0';
+            }
+        }
+    }
+    grid = nextGrid; // Обновляем основную сетку новым поколением
+}
+
+void setupRandom(vector<vector<char>>& grid, int rows, int cols) {
+    const uint64_t seed = nextSessionSeed();
+    uniform_int_distribution<int> dist(0, 3); // 25% клеток будут живыми
+    for (int i = 0; i < rows; ++i) {
+        Philox4x32 engine(seed, (uint64_t)i);
+        for (int j = 0; j < cols; ++j) {
+            grid[i][j] = (dist(engine) == 0) ? '0' : ' ';
+        }
+    }
+}
+
+// Клетки Switch Engine относительно левого верхнего угла
+const vector<pair<int, int>>& switchEnginePattern() {
+    static const vector<pair<int, int>> pattern = {
+        {0, 3},
+        {1, 0}, {1, 3}, {1, 5},
+        {2, 0}, {2, 1}, {2, 5},
+        {3, 5},
+        {4, 4}
+    };
+    return pattern;
+}
+
+// Установка Switch Engine
+void setupSwitchEngine(vector<vector<char>>& grid, int startRow, int startColumn, int rows, int cols) {
+    for(int i=0; i<rows; ++i) fill(grid[i].begin(), grid[i].end(), ' '); // Очищаем сетку
+
+    const vector<pair<int, int>>& pattern = switchEnginePattern();
+
+    // Проверяем, помещается ли паттерн
+    int maxRow = 0, maxColumn = 0;
+    for(const auto& p : pattern) {
+        maxRow = max(maxRow, p.first);
+        maxColumn = max(maxColumn, p.second);
+    }
+
+    if (startRow + maxRow < rows && startColumn + maxColumn < cols) {
+        for (const auto& p : pattern) {
+            grid[startRow + p.first][startColumn + p.second] = '0';
+        }
+    } else {
+        cout << "Предупреждение: Switch Engine не помещается в указанные координаты." << endl
+            << "Попробуйте увеличить размер сетки (рекомендуется хотя бы 10x15 для наблюдения)." << endl;
+    }
+}
+
+// Правило клеточного автомата. Поддерживаются:
+//   B/S-нотация: "B3/S23", "B36/S23", а также старая запись "23/3" (S/B);
+//   Generations: "B2/S/C3", "23/3/8" (S/B/C) - клетка, не выжившая по правилу,
+//   не умирает сразу, а проходит состояния 2..C-1, не считаясь соседом;
+//   Larger than Life: "R5,C0,M1,S34..58,B34..45,NM" - окрестность
+//   (2R+1)x(2R+1), M1 - считать саму клетку, C - число состояний (0 или 2 - два).
+// birth[k]/survive[k] - таблица переходов по числу живых соседей k.
+struct LifeRule {
+    string name = "B3/S23";
+    int states = 2;
+    int radius = 1;
+    bool includeCenter = false;
+    vector<uint8_t> birth = {0, 0, 0, 1, 0, 0, 0, 0, 0};
+    vector<uint8_t> survive = {0, 0, 1, 1, 0, 0, 0, 0, 0};
+
+    int maxCount() const { return (2 * radius + 1) * (2 * radius + 1) - (includeCenter ? 0 : 1); }
+    // Правило вида B/S на 8 соседях - для него есть битовые ядра
+    bool isLifeLike() const { return states == 2 && radius == 1 && !includeCenter; }
+    uint16_t mask(const vector<uint8_t>& table) const {
+        uint16_t m = 0;
+        for (int k = 0; k <= 8 && k < (int)table.size(); ++k) m |= (uint16_t)(table[k] ? 1 << k : 0);
+        return m;
+    }
+    uint16_t birthMask() const { return mask(birth); }
+    uint16_t surviveMask() const { return mask(survive); }
+};
+
+LifeRule parseLifeRule(const string& text) {
+    LifeRule rule;
+    string t;
+    for (char c : text)
+        if (!isspace((unsigned char)c)) t += (char)toupper((unsigned char)c);
+    if (t.empty()) throw invalid_argument("Пустое правило");
+    auto fail = [&]() -> LifeRule { throw invalid_argument("Некорректное правило: " + text); };
+    auto number = [&](const string& s, size_t& i) {
+        if (i >= s.size() || !isdigit((unsigned char)s[i])) fail();
+        long long v = 0;
+        while (i < s.size() && isdigit((unsigned char)s[i])) {
+            v = v * 10 + (s[i++] - '0');
+            if (v > 100000) fail();
+        }
+        return (int)v;
+    };
+
+    if (t[0] == 'R' && t.size() > 1 && isdigit((unsigned char)t[1])) {
+        // Larger than Life: поля через запятую
+        int sMin = -1, sMax = -1, bMin = -1, bMax = -1;
+        size_t i = 0;
+        while (i < t.size()) {
+            const char key = t[i++];
+            if (key == 'N') {
+                if (i >= t.size() || t[i] != 'M') fail(); // Поддерживается только окрестность Мура
+                ++i;
+            } else if (key == 'R') {
+                rule.radius = number(t, i);
+            } else if (key == 'C') {
+                // Состояния хранятся в uint8_t, как и у Generations
+                rule.states = max(2, number(t, i));
+                if (rule.states > 255) fail();
+            } else if (key == 'M') {
+                rule.includeCenter = number(t, i) != 0;
+            } else if (key == 'S' || key == 'B') {
+                int& lo = key == 'S' ? sMin : bMin;
+                int& hi = key == 'S' ? sMax : bMax;
+                lo = number(t, i);
+                if (t.compare(i, 2, "..") != 0) fail();
+                i += 2;
+                hi = number(t, i);
+            } else {
+                fail();
+            }
+            if (i < t.size() && t[i] != ',') fail();
+            if (i < t.size()) ++i;
+        }
+        if (rule.radius < 1 || rule.radius > 100 || sMin < 0 || bMin < 0 || sMin > sMax || bMin > bMax) fail();
+        rule.birth.assign(rule.maxCount() + 1, 0);
+        rule.survive.assign(rule.maxCount() + 1, 0);
+        for (int k = bMin; k <= min(bMax, rule.maxCount()); ++k) rule.birth[k] = 1;
+        for (int k = sMin; k <= min(sMax, rule.maxCount()); ++k) rule.survive[k] = 1;
+        rule.name = "R" + to_string(rule.radius) + ",C" + to_string(rule.states == 2 ? 0 : rule.states) + ",M" + to_string(rule.includeCenter)
+                  + ",S" + to_string(sMin) + ".." + to_string(sMax) + ",B" + to_string(bMin) + ".." + to_string(bMax) + ",NM";
+        return rule;
+    }
+
+    // B/S и Generations: части через '/', с буквами или по позиции S/B/C
+    vector<string> parts;
+    for (size_t from = 0;;) {
+        const size_t slash = t.find('/', from);
+        parts.push_back(t.substr(from, slash == string::npos ? string::npos : slash - from));
+        if (slash == string::npos) break;
+        from = slash + 1;
+    }
+    if (parts.size() < 2 || parts.size() > 3) fail();
+    string birthDigits, surviveDigits;
+    bool haveStates = false;
+    for (size_t p = 0; p < parts.size(); ++p) {
+        string part = parts[p];
+        char kind = p == 0 ? 'S' : (p == 1 ? 'B' : 'C');
+        if (!part.empty() && (part[0] == 'B' || part[0] == 'S' || part[0] == 'C' || part[0] == 'G')) {
+            kind = part[0] == 'G' ? 'C' : part[0];
+            part.erase(0, 1);
+        }
+        if (kind == 'C') {
+            size_t i = 0;
+            rule.states = number(part, i);
+            if (i != part.size() || rule.states < 2 || rule.states > 255) fail();
+            haveStates = true;
+        } else {
+            for (char c : part)
+                if (c < '0' || c > '8') fail();
+            (kind == 'B' ? birthDigits : surviveDigits) = part;
+        }
+    }
+    if (parts.size() == 3 && !haveStates) fail();
+    rule.birth.assign(9, 0);
+    rule.survive.assign(9, 0);
+    for (char c : birthDigits) rule.birth[c - '0'] = 1;
+    for (char c : surviveDigits) rule.survive[c - '0'] = 1;
+    rule.name = "B";
+    for (int k = 0; k <= 8; ++k) if (rule.birth[k]) rule.name += (char)('0' + k);
+    rule.name += "/S";
+    for (int k = 0; k <= 8; ++k) if (rule.survive[k]) rule.name += (char)('0' + k);
+    if (rule.states > 2) rule.name += "/C" + to_string(rule.states);
+    return rule;
+}
+
+// Битовый движок Игры 'Жизнь': одна клетка - один бит в 64-битных словах.
+// Строки лежат подряд в одном буфере. Вокруг поля есть рамка из нулевых слов
+// (по одному слева и справа) и нулевых строк (сверху и снизу), поэтому ядру
+// не нужны проверки границ. Вместо копирования сетки используется двойной буфер.
+struct BitGrid {
+    int rows = 0, cols = 0;
+    int words = 0;          // Слов с клетками в строке
+    int stride = 0;         // Слов в строке вместе с рамкой
+    uint64_t tailMask = 0;  // Допустимые биты последнего слова строки
+    vector<uint64_t> cur, next;
+
+    uint64_t* row(vector<uint64_t>& buf, int r) { return buf.data() + (size_t)(r + 1) * stride + 1; }
+    const uint64_t* row(const vector<uint64_t>& buf, int r) const { return buf.data() + (size_t)(r + 1) * stride + 1; }
+};
+
+BitGrid makeBitGrid(int rows, int cols) {
+    if (rows <= 0 || cols <= 0) throw invalid_argument("Размер битовой сетки должен быть больше нуля");
+    BitGrid g;
+    g.rows = rows;
+    g.cols = cols;
+    g.words = (cols + 63) / 64;
+    g.stride = g.words + 2;
+    g.tailMask = (cols % 64 == 0) ? ~0ULL : ((1ULL << (cols % 64)) - 1);
+    g.cur.assign((size_t)(rows + 2) * g.stride, 0);
+    g.next.assign((size_t)(rows + 2) * g.stride, 0);
+    return g;
+}
+
+inline bool getBitCell(const BitGrid& g, int r, int c) {
+    return (g.row(g.cur, r)[c >> 6] >> (c & 63)) & 1;
+}
+
+inline void setBitCell(BitGrid& g, int r, int c, bool alive) {
+    uint64_t& w = g.row(g.cur, r)[c >> 6];
+    const uint64_t bit = 1ULL << (c & 63);
+    w = alive ? (w | bit) : (w & ~bit);
+}
+
+void bitGridFromChars(BitGrid& g, const vector<vector<char>>& grid) {
+    fill(g.cur.begin(), g.cur.end(), 0);
+    for (int i = 0; i < g.rows; ++i)
+        for (int j = 0; j < g.cols; ++j)
+            if (grid[i][j] == '0') setBitCell(g, i, j, true);
+}
+
+void bitGridToChars(const BitGrid& g, vector<vector<char>>& grid) {
+    for (int i = 0; i < g.rows; ++i)
+        for (int j = 0; j < g.cols; ++j)
+            grid[i][j] = getBitCell(g, i, j) ? '0' : ' ';
+}
+
+// Число соседей клеток слова в битовых срезах: count = b0 + 2*b1 + 4*b2 + 8*b3
+// (восьмой бит нужен только правилам, различающим 0 и 8 соседей), self - сами клетки
+template <typename W>
+struct NeighbourCount {
+    W b0, b1, b2, b3, self;
+};
+
+// Восемь соседей клеток слова mid[0] по трем строкам складываются побитовыми
+// сумматорами, так что все счетчики считаются параллельно. W - uint64_t или
+// векторный тип GCC из нескольких слов: операции те же. Функция встраивается
+// в вызывающую, поэтому компилируется под ее набор инструкций.
+template <typename W>
+__attribute__((always_inline)) inline NeighbourCount<W> countNeighbours(const uint64_t* up, const uint64_t* mid, const uint64_t* dn) {
+    W upPrev, upCur, upNext, midPrev, midCur, midNext, dnPrev, dnCur, dnNext;
+    memcpy(&upPrev, up - 1, sizeof(W));   memcpy(&upCur, up, sizeof(W));   memcpy(&upNext, up + 1, sizeof(W));
+    memcpy(&midPrev, mid - 1, sizeof(W)); memcpy(&midCur, mid, sizeof(W)); memcpy(&midNext, mid + 1, sizeof(W));
+    memcpy(&dnPrev, dn - 1, sizeof(W));   memcpy(&dnCur, dn, sizeof(W));   memcpy(&dnNext, dn + 1, sizeof(W));
+
+    // Соседи слева: бит j-1 сдвигается на место j; справа - бит j+1
+    const W upL = (upCur << 1) | (upPrev >> 63), upR = (upCur >> 1) | (upNext << 63);
+    const W midL = (midCur << 1) | (midPrev >> 63), midR = (midCur >> 1) | (midNext << 63);
+    const W dnL = (dnCur << 1) | (dnPrev >> 63), dnR = (dnCur >> 1) | (dnNext << 63);
+
+    // Верхняя и нижняя тройки - полные сумматоры, средняя пара - полусумматор
+    const W u0 = upL ^ upCur ^ upR, u1 = (upL & upCur) | (upR & (upL ^ upCur));
+    const W d0 = dnL ^ dnCur ^ dnR, d1 = (dnL & dnCur) | (dnR & (dnL ^ dnCur));
+    const W m0 = midL ^ midR, m1 = midL & midR;
+
+    // Складываем три двухбитовых числа
+    const W c0 = (u0 & m0) | (d0 & (u0 ^ m0));
+    const W x = u1 ^ m1 ^ d1;
+    const W y = (u1 & m1) | (d1 & (u1 ^ m1));
+    return {u0 ^ m0 ^ d0, x ^ c0, y ^ (x & c0), y & x & c0, midCur};
+}
+
+// Клетки, число соседей которых входит в правило. Значение правила как
+// функция битов b2, b1, b0 считается деревом мультиплексоров: листья по b0 -
+// это 0, b0, ~b0 или 1, дальше выбор по b1 и b2. leaf[i] отвечает счетчикам
+// 2i и 2i+1. Счетчик 8 выглядит как 0 и отличается от него только битом b3.
+// Векторы возвращаются через ссылку: возврат по значению из функции без
+// target("avx2") меняет ABI, и GCC предупреждает.
+template <typename W>
+__attribute__((always_inline)) inline void selectByCount(const NeighbourCount<W>& n, const W (&leaf)[4], bool flipAtEight, W& res) {
+    const W low = leaf[0] ^ (n.b1 & (leaf[1] ^ leaf[0]));
+    const W high = leaf[2] ^ (n.b1 & (leaf[3] ^ leaf[2]));
+    res = low ^ (n.b2 & (high ^ low));
+    if (flipAtEight) res ^= n.b3;
+}
+
+// Лист дерева для маски-константы: все условия решаются при компиляции,
+// и от дерева остаются только нужные операции
+template <uint16_t Mask, int I, typename W>
+__attribute__((always_inline)) inline void maskLeaf(const NeighbourCount<W>& n, W& leaf) {
+    constexpr bool even = (Mask >> (2 * I)) & 1, odd = (Mask >> (2 * I + 1)) & 1;
+    if constexpr (even && odd) leaf = ~W{};
+    else if constexpr (even) leaf = ~n.b0;
+    else if constexpr (odd) leaf = n.b0;
+    else leaf = W{};
+}
+
+template <uint16_t Mask, typename W>
+__attribute__((always_inline)) inline void countInMask(const NeighbourCount<W>& n, W& res) {
+    W leaf[4];
+    maskLeaf<Mask, 0>(n, leaf[0]);
+    maskLeaf<Mask, 1>(n, leaf[1]);
+    maskLeaf<Mask, 2>(n, leaf[2]);
+    maskLeaf<Mask, 3>(n, leaf[3]);
+    selectByCount(n, leaf, (Mask & 1) != ((Mask >> 8) & 1), res);
+}
+
+// Листья дерева для произвольного правила, собранного без специализации:
+// even/odd - слово из единиц, если счетчик 2i / 2i+1 входит в правило.
+// Принадлежат ядру (BitRowKernel) и передаются в каждый вызов строки;
+// специализированные правила их не читают.
+struct RuntimeRuleMasks {
+    uint64_t birthEven[4] = {}, birthOdd[4] = {}, surviveEven[4] = {}, surviveOdd[4] = {};
+    bool birthFlip = false, surviveFlip = false;
+};
+
+constexpr uint16_t conwayBirth = 1 << 3, conwaySurvive = (1 << 2) | (1 << 3);
+
+// Правило, известное при компиляции: ядро специализируется под маски
+template <uint16_t Birth, uint16_t Survive>
+struct FixedRule {
+    template <typename W>
+    __attribute__((always_inline)) static void apply(const NeighbourCount<W>& n, const RuntimeRuleMasks&, W& next) {
+        if constexpr (Birth == conwayBirth && Survive == conwaySurvive) {
+            // B3/S23: 2 или 3 соседа у живой, 3 у мертвой. Счетчик по модулю 8,
+            // но 8 соседей, как и 0, означают смерть клетки
+            next = ~n.b2 & n.b1 & (n.b0 | n.self);
+        } else {
+            W born, survived;
+            countInMask<Birth>(n, born);
+            countInMask<Survive>(n, survived);
+            next = born ^ (n.self & (survived ^ born));
+        }
+    }
+};
+
+struct RuntimeRule {
+    template <typename W>
+    __attribute__((always_inline)) static void apply(const NeighbourCount<W>& n, const RuntimeRuleMasks& m, W& next) {
+        // Без ветвлений по клеткам: листья выбираются масками ядра
+        W birthLeaf[4], surviveLeaf[4], born, survived;
+#pragma GCC unroll 4
+        for (int i = 0; i < 4; ++i) {
+            birthLeaf[i] = (n.b0 & m.birthOdd[i]) | (~n.b0 & m.birthEven[i]);
+            surviveLeaf[i] = (n.b0 & m.surviveOdd[i]) | (~n.b0 & m.surviveEven[i]);
+        }
+        selectByCount(n, birthLeaf, m.birthFlip, born);
+        selectByCount(n, surviveLeaf, m.surviveFlip, survived);
+        next = born ^ (n.self & (survived ^ born));
+    }
+};
+
+template <typename W, typename Rule = FixedRule<conwayBirth, conwaySurvive>>
+__attribute__((always_inline)) inline void lifeWords(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out,
+                                                     const RuntimeRuleMasks& masks) {
+    W res;
+    Rule::template apply<W>(countNeighbours<W>(up, mid, dn), masks, res);
+    memcpy(out, &res, sizeof(W));
+}
+
+// Обработка строки словами типа W, хвост добивается по одному слову.
+// Указатели up/mid/dn смотрят на первое слово строки, слова рамки
+// по индексам -1 и words должны быть доступны.
+template <typename W, typename Rule = FixedRule<conwayBirth, conwaySurvive>>
+__attribute__((always_inline)) inline void stepBitRowWith(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask,
+                                                          const RuntimeRuleMasks& masks) {
+    constexpr int lanes = sizeof(W) / sizeof(uint64_t);
+    int w = 0;
+    for (; w + lanes <= words; w += lanes) lifeWords<W, Rule>(up + w, mid + w, dn + w, out + w, masks);
+    for (; w < words; ++w) lifeWords<uint64_t, Rule>(up + w, mid + w, dn + w, out + w, masks);
+    out[words - 1] &= tailMask; // Биты за пределами поля остаются мертвыми
+}
+
+template <typename Rule = FixedRule<conwayBirth, conwaySurvive>>
+void stepBitRowRule(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask,
+                    const RuntimeRuleMasks& masks) {
+    stepBitRowWith<uint64_t, Rule>(up, mid, dn, out, words, tailMask, masks);
+}
+
+void stepBitRow(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask,
+                const RuntimeRuleMasks& masks) {
+    stepBitRowRule<>(up, mid, dn, out, words, tailMask, masks);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+typedef uint64_t U64x2 __attribute__((vector_size(16)));
+typedef uint64_t U64x4 __attribute__((vector_size(32)));
+
+// 128 клеток за инструкцию
+template <typename Rule = FixedRule<conwayBirth, conwaySurvive>>
+__attribute__((target("sse2")))
+void stepBitRowRuleSSE2(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask,
+                        const RuntimeRuleMasks& masks) {
+    stepBitRowWith<U64x2, Rule>(up, mid, dn, out, words, tailMask, masks);
+}
+
+// 256 клеток за инструкцию
+template <typename Rule = FixedRule<conwayBirth, conwaySurvive>>
+__attribute__((target("avx2")))
+void stepBitRowRuleAVX2(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask,
+                        const RuntimeRuleMasks& masks) {
+    stepBitRowWith<U64x4, Rule>(up, mid, dn, out, words, tailMask, masks);
+}
+
+void stepBitRowSSE2(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask,
+                    const RuntimeRuleMasks& masks) {
+    stepBitRowRuleSSE2<>(up, mid, dn, out, words, tailMask, masks);
+}
+
+void stepBitRowAVX2(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask,
+                    const RuntimeRuleMasks& masks) {
+    stepBitRowRuleAVX2<>(up, mid, dn, out, words, tailMask, masks);
+}
+#endif
+
+using BitRowFunction = void (*)(const uint64_t*, const uint64_t*, const uint64_t*, uint64_t*, int, uint64_t,
+                                const RuntimeRuleMasks&);
+
+// Ядро строки вместе с масками своего правила: два ядра разных правил
+// не делят никакого состояния, и копию ядра можно отдать в любой поток
+struct BitRowKernel {
+    BitRowFunction step;
+    RuntimeRuleMasks masks;
+
+    BitRowKernel(BitRowFunction step = stepBitRow) : step(step) {}
+    void operator()(const uint64_t* up, const uint64_t* mid, const uint64_t* dn, uint64_t* out, int words, uint64_t tailMask) const {
+        step(up, mid, dn, out, words, tailMask, masks);
+    }
+};
+
+enum class LifeISA { Scalar, SSE2, AVX2 };
+
+struct LifeKernel {
+    const char* name;
+    BitRowFunction step;
+    LifeISA isa;
+};
+
+// Выбор лучшего ядра по возможностям процессора, один раз за запуск
+const LifeKernel& activeLifeKernel() {
+    static const LifeKernel kernel = []() -> LifeKernel {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) return {"AVX2", stepBitRowAVX2, LifeISA::AVX2};
+        if (__builtin_cpu_supports("sse2")) return {"SSE2", stepBitRowSSE2, LifeISA::SSE2};
+#endif
+        return {"скалярное", stepBitRow, LifeISA::Scalar};
+    }();
+    return kernel;
+}
+
+// Ядро для правила B/S. Популярные правила собраны со специализацией под
+// свои маски и работают так же быстро, как B3/S23; остальные идут через
+// ядро, читающее маски правила из BitRowKernel. Вариант - по набору инструкций.
+struct RuleKernelSet {
+    uint16_t birth, survive;
+    BitRowFunction scalar, sse2, avx2;
+};
+
+template <typename Rule>
+constexpr RuleKernelSet ruleKernels(uint16_t birth, uint16_t survive) {
+#if defined(__x86_64__) || defined(__i386__)
+    return {birth, survive, stepBitRowRule<Rule>, stepBitRowRuleSSE2<Rule>, stepBitRowRuleAVX2<Rule>};
+#else
+    return {birth, survive, stepBitRowRule<Rule>, stepBitRowRule<Rule>, stepBitRowRule<Rule>};
+#endif
+}
+
+template <uint16_t Birth, uint16_t Survive>
+constexpr RuleKernelSet fixedRuleKernels() {
+    return ruleKernels<FixedRule<Birth, Survive>>(Birth, Survive);
+}
+
+constexpr uint16_t ruleMask(const char* digits) {
+    uint16_t m = 0;
+    for (; *digits; ++digits) m |= (uint16_t)(1 << (*digits - '0'));
+    return m;
+}
+
+// simd = false - скалярный вариант ядра того же правила
+BitRowKernel lifeRuleKernel(const LifeRule& rule, bool simd = true) {
+    if (!rule.isLifeLike()) throw invalid_argument("Правило " + rule.name + " не считается битовыми ядрами");
+    static const RuleKernelSet specialized[] = {
+        fixedRuleKernels<ruleMask("3"), ruleMask("23")>(),        // Conway
+        fixedRuleKernels<ruleMask("36"), ruleMask("23")>(),       // HighLife
+        fixedRuleKernels<ruleMask("3678"), ruleMask("34678")>(),  // Day & Night
+        fixedRuleKernels<ruleMask("2"), ruleMask("")>(),          // Seeds
+        fixedRuleKernels<ruleMask("1357"), ruleMask("1357")>(),   // Replicator
+        fixedRuleKernels<ruleMask("368"), ruleMask("245")>(),     // Morley
+        fixedRuleKernels<ruleMask("36"), ruleMask("125")>(),      // 2x2
+        fixedRuleKernels<ruleMask("3"), ruleMask("012345678")>(), // Life without Death
+    };
+    static const RuleKernelSet runtime = ruleKernels<RuntimeRule>(0, 0);
+
+    const uint16_t birth = rule.birthMask(), survive = rule.surviveMask();
+    const RuleKernelSet* set = &runtime;
+    for (const RuleKernelSet& s : specialized)
+        if (s.birth == birth && s.survive == survive) set = &s;
+
+    const LifeISA isa = simd ? activeLifeKernel().isa : LifeISA::Scalar;
+    BitRowKernel kernel(isa == LifeISA::AVX2 ? set->avx2 : (isa == LifeISA::SSE2 ? set->sse2 : set->scalar));
+    if (set == &runtime) {
+        for (int i = 0; i < 4; ++i) {
+            kernel.masks.birthEven[i] = rule.birth[2 * i] ? ~0ULL : 0;
+            kernel.masks.birthOdd[i] = rule.birth[2 * i + 1] ? ~0ULL : 0;
+            kernel.masks.surviveEven[i] = rule.survive[2 * i] ? ~0ULL : 0;
+            kernel.masks.surviveOdd[i] = rule.survive[2 * i + 1] ? ~0ULL : 0;
+        }
+        kernel.masks.birthFlip = rule.birth[0] != rule.birth[8];
+        kernel.masks.surviveFlip = rule.survive[0] != rule.survive[8];
+    }
+    return kernel;
+}
+
+void stepBitGrid(BitGrid& g, BitRowKernel kernel = stepBitRow) {
+    for (int r = 0; r < g.rows; ++r) {
+        kernel(g.row(g.cur, r - 1), g.row(g.cur, r), g.row(g.cur, r + 1), g.row(g.next, r), g.words, g.tailMask);
+    }
+    g.cur.swap(g.next);
+}
+
+// Тор: поле замыкается по обеим осям. Перед шагом рамка текущего буфера
+// заполняется копиями противоположных краев, после шага рамка старого буфера
+// снова обнуляется, чтобы остальные движки видели мертвую границу.
+void fillTorusHalo(BitGrid& g) {
+    const int lastWord = g.words - 1;
+    const int tailBit = g.cols % 64;
+    for (int r = 0; r < g.rows; ++r) {
+        uint64_t* row = g.row(g.cur, r);
+        const uint64_t first = row[0] & 1, last = (row[lastWord] >> ((g.cols - 1) & 63)) & 1;
+        row[-1] = last << 63;
+        // Правый сосед последнего столбца - бит сразу за ним: либо лишний бит
+        // последнего слова (его отрежет tailMask), либо слово рамки
+        if (tailBit != 0) row[lastWord] = (row[lastWord] & g.tailMask) | (first << tailBit);
+        row[g.words] = tailBit != 0 ? 0 : first;
+    }
+    const size_t rowBytes = g.stride * sizeof(uint64_t);
+    memcpy(g.row(g.cur, -1) - 1, g.row(g.cur, g.rows - 1) - 1, rowBytes);
+    memcpy(g.row(g.cur, g.rows) - 1, g.row(g.cur, 0) - 1, rowBytes);
+}
+
+void clearBitGridFrame(BitGrid& g, vector<uint64_t>& buf) {
+    const size_t rowBytes = g.stride * sizeof(uint64_t);
+    memset(g.row(buf, -1) - 1, 0, rowBytes);
+    memset(g.row(buf, g.rows) - 1, 0, rowBytes);
+    for (int r = 0; r < g.rows; ++r) {
+        uint64_t* row = g.row(buf, r);
+        row[-1] = 0;
+        row[g.words - 1] &= g.tailMask;
+        row[g.words] = 0;
+    }
+}
+
+void stepBitGridTorus(BitGrid& g, BitRowKernel kernel = stepBitRow) {
+    fillTorusHalo(g);
+    stepBitGrid(g, kernel);
+    clearBitGridFrame(g, g.next);
+}
+
+// Барьер, на котором рабочие потоки встречаются раз в поколение
+class GenerationBarrier {
+public:
+    explicit GenerationBarrier(int count) : count(count) {}
+
+    void arriveAndWait() {
+        unique_lock<mutex> lock(m);
+        const uint64_t phase = currentPhase;
+        if (++waiting == count) {
+            waiting = 0;
+            ++currentPhase;
+            cv.notify_all();
+        } else {
+            cv.wait(lock, [&] { return currentPhase != phase; });
+        }
+    }
+
+private:
+    mutex m;
+    condition_variable cv;
+    const int count;
+    int waiting = 0;
+    uint64_t currentPhase = 0;
+};
+
+// Многопоточный шаг битового поля на generations поколений.
+// Поле режется на горизонтальные полосы, по одной на поток. Каждая полоса -
+// отдельное битовое поле, строки рамки которого служат ореолом (halo): копиями
+// крайних строк соседних полос. После расчета поколения поток записывает свои
+// крайние строки в ореолы соседей и ждет на барьере - одна синхронизация на
+// поколение. Буферы выбираются по четности поколения, поэтому сосед может
+// писать в ореол следующего буфера, пока полоса еще читает текущий.
+void stepBitGridParallel(BitGrid& grid, int generations, int threads, BitRowKernel kernel = activeLifeKernel().step) {
+    if (generations <= 0) return;
+    if (threads <= 0) threads = defaultThreadCount();
+    const int bandCount = max(1, min(threads, grid.rows));
+    const size_t rowBytes = grid.stride * sizeof(uint64_t);
+
+    vector<int> firstRow(bandCount + 1);
+    for (int b = 0; b <= bandCount; ++b) firstRow[b] = static_cast<int>((long long)grid.rows * b / bandCount);
+
+    vector<BitGrid> bands(bandCount);
+    for (int b = 0; b < bandCount; ++b) {
+        bands[b] = makeBitGrid(firstRow[b + 1] - firstRow[b], grid.cols);
+        // Строки полосы вместе с ореолами; рамка исходного поля нулевая
+        for (int r = -1; r <= bands[b].rows; ++r)
+            memcpy(bands[b].row(bands[b].cur, r) - 1, grid.row(grid.cur, firstRow[b] + r) - 1, rowBytes);
+    }
+
+    GenerationBarrier barrier(bandCount);
+    auto worker = [&](int b) {
+        BitGrid& band = bands[b];
+        for (int gen = 0; gen < generations; ++gen) {
+            const bool even = gen % 2 == 0;
+            const vector<uint64_t>& src = even ? band.cur : band.next;
+            vector<uint64_t>& dst = even ? band.next : band.cur;
+            for (int r = 0; r < band.rows; ++r)
+                kernel(band.row(src, r - 1), band.row(src, r), band.row(src, r + 1), band.row(dst, r), band.words, band.tailMask);
+
+            // Обмен ореолами: первая строка уходит верхнему соседу, последняя - нижнему
+            if (b > 0) {
+                BitGrid& upper = bands[b - 1];
+                memcpy(upper.row(even ? upper.next : upper.cur, upper.rows), band.row(dst, 0), band.words * sizeof(uint64_t));
+            }
+            if (b + 1 < bandCount) {
+                BitGrid& lower = bands[b + 1];
+                memcpy(lower.row(even ? lower.next : lower.cur, -1), band.row(dst, band.rows - 1), band.words * sizeof(uint64_t));
+            }
+            barrier.arriveAndWait();
+        }
+    };
+
+    vector<thread> pool;
+    for (int b = 1; b < bandCount; ++b) pool.emplace_back(worker, b);
+    worker(0);
+    for (thread& t : pool) t.join();
+
+    for (int b = 0; b < bandCount; ++b) {
+        const vector<uint64_t>& result = (generations % 2 == 0) ? bands[b].cur : bands[b].next;
+        for (int r = 0; r < bands[b].rows; ++r)
+            memcpy(grid.row(grid.cur, firstRow[b] + r), bands[b].row(result, r), bands[b].words * sizeof(uint64_t));
+    }
+}
+
+// HashLife: поле - бесконечная мертвая плоскость в виде квадродерева.
+// Одинаковые поддеревья хранятся один раз (hash-consing), а для каждого узла
+// запоминается RESULT - его центр, продвинутый на 2^k поколений. Благодаря
+// этому периодические и повторяющиеся структуры считаются один раз, и прыжок
+// на 2^k поколений стоит O(k) уровней дерева, а не O(2^k) шагов.
+// Корень всегда центрирован в точке (0, 0); клетка (r, c) сетки - это (x=c, y=r).
+class HashLife {
+public:
+    struct Node {
+        Node* nw = nullptr;
+        Node* ne = nullptr;
+        Node* sw = nullptr;
+        Node* se = nullptr;
+        Node* result = nullptr;       // Центр узла через 2^resultLog поколений
+        Node* nextInBucket = nullptr; // Цепочка в хеш-таблице
+        uint64_t population = 0;
+        int level = 0;                // Узел уровня L - квадрат 2^L x 2^L; -1 у свободного
+        int resultLog = -1;           // min(stepLog, L - 2) на момент расчета result
+        bool marked = false;
+    };
+
+    // maxNodes - жесткий лимит числа узлов. Когда после прыжка занято больше
+    // порога (сначала 1/4 лимита), собирается мусор и очищается кеш
+    // результатов; если сборка освободила мало, порог удваивается, пока не
+    // дойдет до самого лимита, чтобы не собирать мусор после каждого прыжка. Если лимит
+    // достигнут посреди прыжка, недостроенные результаты выбрасываются, и
+    // прыжок делится на два вдвое меньших; если не помещается и шаг на одно
+    // поколение - runtime_error.
+    // Правило - любое B/S без B0: пустая плоскость должна оставаться пустой.
+    explicit HashLife(size_t maxNodes = 1 << 22, const LifeRule& rule = LifeRule())
+        : maxNodes(maxNodes), buckets(1 << 16, nullptr), birthMask(rule.birthMask()), surviveMask(rule.surviveMask()) {
+        if (!rule.isLifeLike() || rule.birth[0])
+            throw invalid_argument("HashLife поддерживает только двухцветные правила B/S без B0");
+        for (int v = 0; v < 2; ++v) {
+            leaf[v].level = 0;
+            leaf[v].population = v;
+        }
+        root = emptyNode(3);
+    }
+
+    HashLife(const HashLife&) = delete;
+    HashLife& operator=(const HashLife&) = delete;
+
+    void loadFromBitGrid(const BitGrid& grid) {
+        int level = 3;
+        while ((1LL << (level - 1)) < max(grid.rows, grid.cols)) ++level;
+        root = build(grid, level, -(1LL << (level - 1)), -(1LL << (level - 1)));
+        generationCount = 0;
+    }
+
+    // Живые клетки (строка, столбец) в координатах плоскости, как их отдает
+    // forEachLiveCell; координаты могут быть отрицательными
+    void loadCells(vector<pair<long long, long long>> cells) {
+        long long extent = 1;
+        for (const auto& c : cells) extent = max({extent, llabs(c.first) + 1, llabs(c.second) + 1});
+        int level = 3;
+        while ((1LL << (level - 1)) < extent) {
+            if (++level >= 60) throw overflow_error("Паттерн HashLife вышел за пределы координат");
+        }
+        root = buildCells(cells.begin(), cells.end(), level, -(1LL << (level - 1)), -(1LL << (level - 1)));
+        generationCount = 0;
+    }
+
+    // Копирует окно [0, rows) x [0, cols) плоскости в сетку
+    void copyToBitGrid(BitGrid& grid) const {
+        fill(grid.cur.begin(), grid.cur.end(), 0);
+        const long long half = 1LL << (root->level - 1);
+        copyWindow(root, -half, -half, grid);
+    }
+
+    // Прыжок ровно на 2^k поколений
+    void advancePow2(int k) {
+        if (k < 0 || k > 56) throw out_of_range("Показатель прыжка HashLife должен быть от 0 до 56");
+        try {
+            jump(k);
+            return;
+        } catch (const NodeLimitReached&) {
+            // Корень еще прежний: все, что построено за прыжок, - мусор
+            collectGarbage();
+        }
+        if (k > 0) {
+            advancePow2(k - 1);
+            advancePow2(k - 1);
+            return;
+        }
+        try {
+            jump(0);
+        } catch (const NodeLimitReached&) {
+            collectGarbage();
+            throw runtime_error("HashLife: паттерн не помещается в лимит " + to_string(maxNodes) + " узлов");
+        }
+    }
+
+    // Произвольное число поколений раскладывается по степеням двойки
+    void advance(uint64_t generations) {
+        for (int k = 0; generations != 0; ++k, generations >>= 1)
+            if (generations & 1) advancePow2(k);
+    }
+
+    uint64_t population() const { return root->population; }
+    uint64_t generation() const { return generationCount; }
+    size_t nodeCount() const { return liveNodes; }
+    size_t nodeLimit() const { return maxNodes; }
+
+    // Обход живых клеток плоскости: f(строка, столбец)
+    template <typename F>
+    void forEachLiveCell(F&& f) const {
+        const long long half = 1LL << (root->level - 1);
+        visitLive(root, -half, -half, f);
+    }
+
+private:
+    // Бросает allocate, когда узлов столько же, сколько разрешено лимитом
+    struct NodeLimitReached : runtime_error {
+        explicit NodeLimitReached(size_t limit)
+            : runtime_error("HashLife: достигнут лимит " + to_string(limit) + " узлов") {}
+    };
+
+    void jump(int k) {
+        setStepLog(k);
+        // Узел уровня L продвигает свой центр не дальше, чем на 2^(L-3) клеток
+        // от центральной четверти, поэтому паттерн должен лежать в ней целиком
+        while (root->level < k + 3 || !fitsInCenter(root)) root = expand(root);
+        root = result(root);
+        generationCount += 1ULL << k;
+        if (liveNodes > gcThreshold) {
+            collectGarbage();
+            if (liveNodes > gcThreshold / 2) gcThreshold = min(maxNodes, gcThreshold * 2);
+        }
+    }
+
+    template <typename F>
+    static void visitLive(const Node* n, long long x0, long long y0, F& f) {
+        if (n->population == 0) return;
+        if (n->level == 0) {
+            f(y0, x0);
+            return;
+        }
+        const long long half = 1LL << (n->level - 1);
+        visitLive(n->nw, x0, y0, f);
+        visitLive(n->ne, x0 + half, y0, f);
+        visitLive(n->sw, x0, y0 + half, f);
+        visitLive(n->se, x0 + half, y0 + half, f);
+    }
+
+    static constexpr size_t blockSize = 1 << 16;
+
+    Node leaf[2];
+    vector<Node*> empties;          // Пустые узлы по уровням
+    Node* root = nullptr;
+    vector<unique_ptr<Node[]>> blocks;
+    Node* freeList = nullptr;
+    size_t liveNodes = 0;
+    const size_t maxNodes;
+    size_t gcThreshold = maxNodes / 4; // Порог сборки мусора после прыжка
+    vector<Node*> buckets;
+    int stepLog = -1;               // Шаг текущего прыжка: 2^stepLog
+    uint16_t birthMask, surviveMask;
+    uint64_t generationCount = 0;
+
+    static size_t hashChildren(const Node* nw, const Node* ne, const Node* sw, const Node* se) {
+        uint64_t h = reinterpret_cast<uintptr_t>(nw) * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ reinterpret_cast<uintptr_t>(ne)) * 0xC2B2AE3D27D4EB4FULL;
+        h = (h ^ reinterpret_cast<uintptr_t>(sw)) * 0x165667B19E3779F9ULL;
+        h = (h ^ reinterpret_cast<uintptr_t>(se)) * 0x27D4EB2F165667C5ULL;
+        return static_cast<size_t>(h ^ (h >> 29));
+    }
+
+    Node* allocate() {
+        if (liveNodes >= maxNodes) throw NodeLimitReached(maxNodes);
+        if (!freeList) {
+            blocks.emplace_back(new Node[blockSize]);
+            Node* block = blocks.back().get();
+            for (size_t i = 0; i < blockSize; ++i) {
+                block[i].level = -1;
+                block[i].nextInBucket = freeList;
+                freeList = &block[i];
+            }
+        }
+        Node* n = freeList;
+        freeList = n->nextInBucket;
+        ++liveNodes;
+        return n;
+    }
+
+    void rehash(size_t bucketCount) {
+        vector<Node*> fresh(bucketCount, nullptr);
+        for (Node* head : buckets) {
+            while (head) {
+                Node* next = head->nextInBucket;
+                const size_t b = hashChildren(head->nw, head->ne, head->sw, head->se) & (bucketCount - 1);
+                head->nextInBucket = fresh[b];
+                fresh[b] = head;
+                head = next;
+            }
+        }
+        buckets.swap(fresh);
+    }
+
+    // Единственная точка создания узлов: одинаковые четверки дают один узел
+    Node* join(Node* nw, Node* ne, Node* sw, Node* se) {
+        const size_t h = hashChildren(nw, ne, sw, se);
+        for (Node* n = buckets[h & (buckets.size() - 1)]; n; n = n->nextInBucket)
+            if (n->nw == nw && n->ne == ne && n->sw == sw && n->se == se) return n;
+
+        if (liveNodes >= buckets.size()) rehash(buckets.size() * 2);
+        Node* n = allocate();
+        n->nw = nw; n->ne = ne; n->sw = sw; n->se = se;
+        n->result = nullptr;
+        n->level = nw->level + 1;
+        n->population = nw->population + ne->population + sw->population + se->population;
+        n->marked = false;
+        Node*& bucket = buckets[h & (buckets.size() - 1)];
+        n->nextInBucket = bucket;
+        bucket = n;
+        return n;
+    }
+
+    Node* emptyNode(int level) {
+        if (level == 0) return &leaf[0];
+        while ((int)empties.size() <= level) empties.push_back(nullptr);
+        if (!empties[level]) {
+            Node* sub = emptyNode(level - 1);
+            empties[level] = join(sub, sub, sub, sub);
+        }
+        return empties[level];
+    }
+
+    Node* build(const BitGrid& grid, int level, long long x0, long long y0) {
+        const long long size = 1LL << level;
+        if (x0 >= grid.cols || y0 >= grid.rows || x0 + size <= 0 || y0 + size <= 0) return emptyNode(level);
+        if (level == 0) return &leaf[getBitCell(grid, (int)y0, (int)x0) ? 1 : 0];
+        const long long half = size / 2;
+        return join(build(grid, level - 1, x0, y0), build(grid, level - 1, x0 + half, y0),
+                    build(grid, level - 1, x0, y0 + half), build(grid, level - 1, x0 + half, y0 + half));
+    }
+
+    // Клетки [first, last) лежат в квадрате узла; делятся на четверти на месте
+    using CellIterator = vector<pair<long long, long long>>::iterator;
+    Node* buildCells(CellIterator first, CellIterator last, int level, long long x0, long long y0) {
+        if (first == last) return emptyNode(level);
+        if (level == 0) return &leaf[1];
+        const long long half = 1LL << (level - 1);
+        const CellIterator south = partition(first, last, [&](const pair<long long, long long>& c) { return c.first < y0 + half; });
+        const CellIterator northEast = partition(first, south, [&](const pair<long long, long long>& c) { return c.second < x0 + half; });
+        const CellIterator southEast = partition(south, last, [&](const pair<long long, long long>& c) { return c.second < x0 + half; });
+        return join(buildCells(first, northEast, level - 1, x0, y0), buildCells(northEast, south, level - 1, x0 + half, y0),
+                    buildCells(south, southEast, level - 1, x0, y0 + half), buildCells(southEast, last, level - 1, x0 + half, y0 + half));
+    }
+
+    void copyWindow(const Node* n, long long x0, long long y0, BitGrid& grid) const {
+        const long long size = 1LL << n->level;
+        if (n->population == 0 || x0 >= grid.cols || y0 >= grid.rows || x0 + size <= 0 || y0 + size <= 0) return;
+        if (n->level == 0) {
+            setBitCell(grid, (int)y0, (int)x0, true);
+            return;
+        }
+        const long long half = size / 2;
+        copyWindow(n->nw, x0, y0, grid);
+        copyWindow(n->ne, x0 + half, y0, grid);
+        copyWindow(n->sw, x0, y0 + half, grid);
+        copyWindow(n->se, x0 + half, y0 + half, grid);
+    }
+
+    bool fitsInCenter(const Node* n) const {
+        return n->nw->se->se->population + n->ne->sw->sw->population +
+               n->sw->ne->ne->population + n->se->nw->nw->population == n->population;
+    }
+
+    // Увеличение корня на уровень с сохранением центра
+    Node* expand(Node* n) {
+        if (n->level >= 60) throw overflow_error("Паттерн HashLife вышел за пределы координат");
+        Node* e = emptyNode(n->level - 1);
+        return join(join(e, e, e, n->nw), join(e, e, n->ne, e),
+                    join(e, n->sw, e, e), join(n->se, e, e, e));
+    }
+
+    // Центральный подузел уровня L-1 без продвижения во времени
+    Node* centered(Node* n) { return join(n->nw->se, n->ne->sw, n->sw->ne, n->se->nw); }
+    // Подузел на стыке двух соседних узлов того же уровня
+    Node* centeredHorizontal(Node* w, Node* e) { return join(w->ne, e->nw, w->se, e->sw); }
+    Node* centeredVertical(Node* n, Node* s) { return join(n->sw, n->se, s->nw, s->ne); }
+
+    // Узел 4x4: центр 2x2 через одно поколение считается напрямую
+    Node* baseResult(Node* n) {
+        int cells[4][4];
+        const Node* quads[2][2] = {{n->nw, n->ne}, {n->sw, n->se}};
+        for (int qy = 0; qy < 2; ++qy) {
+            for (int qx = 0; qx < 2; ++qx) {
+                const Node* q = quads[qy][qx];
+                cells[qy * 2][qx * 2] = (int)q->nw->population;
+                cells[qy * 2][qx * 2 + 1] = (int)q->ne->population;
+                cells[qy * 2 + 1][qx * 2] = (int)q->sw->population;
+                cells[qy * 2 + 1][qx * 2 + 1] = (int)q->se->population;
+            }
+        }
+        Node* next[2][2];
+        for (int y = 1; y <= 2; ++y) {
+            for (int x = 1; x <= 2; ++x) {
+                int neighbours = -cells[y][x];
+                for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx)
+                        neighbours += cells[y + dy][x + dx];
+                const bool alive = (((cells[y][x] ? surviveMask : birthMask) >> neighbours) & 1) != 0;
+                next[y - 1][x - 1] = &leaf[alive ? 1 : 0];
+            }
+        }
+        return join(next[0][0], next[0][1], next[1][0], next[1][1]);
+    }
+
+    // RESULT: центр узла уровня L (уровень L-1) через min(2^(L-2), 2^stepLog) поколений.
+    // Результат зависит только от min(stepLog, L - 2): узлы, которые при
+    // прошлом шаге считались на полной скорости, годятся и для большего шага,
+    // так что смена шага между прыжками не сбрасывает кеш нижних уровней
+    Node* result(Node* n) {
+        const int effectiveLog = min(stepLog, n->level - 2);
+        if (n->result && n->resultLog == effectiveLog) return n->result;
+        Node* r;
+        if (n->population == 0) {
+            r = emptyNode(n->level - 1);
+        } else if (n->level == 2) {
+            r = baseResult(n);
+        } else {
+            // Девять перекрывающихся подузлов уровня L-1
+            Node* n00 = n->nw;
+            Node* n01 = centeredHorizontal(n->nw, n->ne);
+            Node* n02 = n->ne;
+            Node* n10 = centeredVertical(n->nw, n->sw);
+            Node* n11 = centered(n);
+            Node* n12 = centeredVertical(n->ne, n->se);
+            Node* n20 = n->sw;
+            Node* n21 = centeredHorizontal(n->sw, n->se);
+            Node* n22 = n->se;
+
+            // Первая половина шага
+            Node* a00 = result(n00); Node* a01 = result(n01); Node* a02 = result(n02);
+            Node* a10 = result(n10); Node* a11 = result(n11); Node* a12 = result(n12);
+            Node* a20 = result(n20); Node* a21 = result(n21); Node* a22 = result(n22);
+
+            Node* q00 = join(a00, a01, a10, a11);
+            Node* q01 = join(a01, a02, a11, a12);
+            Node* q10 = join(a10, a11, a20, a21);
+            Node* q11 = join(a11, a12, a21, a22);
+
+            if (stepLog >= n->level - 2) {
+                // Полная скорость: вторая половина шага
+                r = join(result(q00), result(q01), result(q10), result(q11));
+            } else {
+                // Шаг меньше 2^(L-2): берем центры без продвижения
+                r = join(centered(q00), centered(q01), centered(q10), centered(q11));
+            }
+        }
+        n->result = r;
+        n->resultLog = effectiveLog;
+        return r;
+    }
+
+    // Кеш не сбрасывается: result сверяет resultLog узла с новым шагом
+    void setStepLog(int k) { stepLog = k; }
+
+    void mark(Node* n) {
+        if (n->level <= 0 || n->marked) return;
+        n->marked = true;
+        mark(n->nw); mark(n->ne); mark(n->sw); mark(n->se);
+    }
+
+    // Сохраняются только узлы, достижимые из корня, и пустые узлы.
+    // Кеш результатов сбрасывается целиком: он восстановится по мере счета.
+    void collectGarbage() {
+        mark(root);
+        for (Node* e : empties) if (e) mark(e);
+        for (Node*& head : buckets) head = nullptr;
+        for (auto& block : blocks) {
+            for (size_t i = 0; i < blockSize; ++i) {
+                Node& n = block[i];
+                if (n.level < 0) continue;
+                n.result = nullptr;
+                if (n.marked) {
+                    n.marked = false;
+                    Node*& bucket = buckets[hashChildren(n.nw, n.ne, n.sw, n.se) & (buckets.size() - 1)];
+                    n.nextInBucket = bucket;
+                    bucket = &n;
+                } else {
+                    n.level = -1;
+                    n.nextInBucket = freeList;
+                    freeList = &n;
+                    --liveNodes;
+                }
+            }
+        }
+    }
+};
+
+// Поле, разбитое на плитки 64x64 (одно слово в ширину, 64 строки в высоту).
+// Плитка пересчитывается, только если в прошлом поколении изменилась она
+// сама или одна из восьми соседних: остальные клетки не могут измениться.
+// У неизменившейся плитки второй буфер уже совпадает с текущим, поэтому
+// двойной буфер работает без копирования и для пропущенных плиток.
+struct TiledLife {
+    static constexpr int tileRowsLog = 6; // 64 строки в плитке
+
+    BitGrid grid;
+    int tileRows = 0, tileCols = 0;
+    vector<uint8_t> changed;       // Плитка изменилась на прошлом шаге
+    vector<uint8_t> active;        // Плитка пересчитывается на текущем шаге
+    vector<uint64_t> rowDiff;      // Накопленные по полосе отличия слов
+    size_t activeTiles = 0;        // Плиток, пересчитанных на последнем шаге
+};
+
+TiledLife makeTiledLife(const BitGrid& grid) {
+    TiledLife t;
+    t.grid = grid;
+    t.grid.next = t.grid.cur;
+    t.tileRows = (grid.rows + (1 << TiledLife::tileRowsLog) - 1) >> TiledLife::tileRowsLog;
+    t.tileCols = grid.words;
+    // На первом шаге считается все поле
+    t.changed.assign((size_t)t.tileRows * t.tileCols, 1);
+    t.active.assign(t.changed.size(), 0);
+    t.rowDiff.assign(grid.words, 0);
+    return t;
+}
+
+void stepTiledLife(TiledLife& t, BitRowKernel kernel = activeLifeKernel().step) {
+    BitGrid& g = t.grid;
+    t.activeTiles = 0;
+    for (int ty = 0; ty < t.tileRows; ++ty) {
+        for (int tx = 0; tx < t.tileCols; ++tx) {
+            uint8_t any = 0;
+            for (int dy = max(0, ty - 1); dy <= min(t.tileRows - 1, ty + 1); ++dy)
+                for (int dx = max(0, tx - 1); dx <= min(t.tileCols - 1, tx + 1); ++dx)
+                    any |= t.changed[(size_t)dy * t.tileCols + dx];
+            t.active[(size_t)ty * t.tileCols + tx] = any;
+            t.activeTiles += any;
+        }
+    }
+
+    for (int ty = 0; ty < t.tileRows; ++ty) {
+        const uint8_t* activeRow = &t.active[(size_t)ty * t.tileCols];
+        uint8_t* changedRow = &t.changed[(size_t)ty * t.tileCols];
+        const int r0 = ty << TiledLife::tileRowsLog;
+        const int r1 = min(g.rows, r0 + (1 << TiledLife::tileRowsLog));
+        // Подряд идущие активные плитки считаются одним вызовом ядра,
+        // чтобы SIMD-ядро работало на длинных отрезках строки
+        for (int x0 = 0; x0 < t.tileCols;) {
+            if (!activeRow[x0]) {
+                changedRow[x0++] = 0;
+                continue;
+            }
+            int x1 = x0;
+            while (x1 < t.tileCols && activeRow[x1]) ++x1;
+            const int runWords = x1 - x0;
+            const uint64_t runMask = (x1 == g.words) ? g.tailMask : ~0ULL;
+            fill(t.rowDiff.begin() + x0, t.rowDiff.begin() + x1, 0);
+            for (int r = r0; r < r1; ++r) {
+                const uint64_t* mid = g.row(g.cur, r) + x0;
+                uint64_t* out = g.row(g.next, r) + x0;
+                kernel(g.row(g.cur, r - 1) + x0, mid, g.row(g.cur, r + 1) + x0, out, runWords, runMask);
+                for (int w = 0; w < runWords; ++w) t.rowDiff[x0 + w] |= out[w] ^ mid[w];
+            }
+            for (int x = x0; x < x1; ++x) changedRow[x] = t.rowDiff[x] != 0;
+            x0 = x1;
+        }
+    }
+    g.cur.swap(g.next);
+}
+
+// Бесконечная плоскость из блоков 64x64 в хеш-таблице: блок строки - одно
+// слово. Блок появляется, когда в нем оживает клетка, и удаляется, когда
+// он пустеет, поэтому память растет с населением, а не с площадью рамки.
+// Координаты ячеек знаковые, клетка (r, c) лежит в блоке (r >> 6, c >> 6).
+struct SparseLife {
+    using Chunk = array<uint64_t, 64>;
+
+    unordered_map<uint64_t, Chunk> chunks, nextChunks;
+    BitRowKernel kernel = stepBitRow; // Ядро правила, см. setSparseRule
+    vector<uint64_t> candidates;
+    uint64_t generation = 0;
+
+    static uint64_t key(int64_t cy, int64_t cx) { return ((uint64_t)(uint32_t)cy << 32) | (uint32_t)cx; }
+    static int64_t keyY(uint64_t k) { return (int32_t)(k >> 32); }
+    static int64_t keyX(uint64_t k) { return (int32_t)(uint32_t)k; }
+};
+
+void setSparseCell(SparseLife& s, int64_t r, int64_t c, bool alive) {
+    const uint64_t k = SparseLife::key(r >> 6, c >> 6);
+    const uint64_t bit = 1ULL << (c & 63);
+    if (alive) {
+        auto it = s.chunks.find(k);
+        if (it == s.chunks.end()) it = s.chunks.emplace(k, SparseLife::Chunk{}).first;
+        it->second[r & 63] |= bit;
+        return;
+    }
+    auto it = s.chunks.find(k);
+    if (it == s.chunks.end()) return;
+    it->second[r & 63] &= ~bit;
+    if (all_of(it->second.begin(), it->second.end(), [](uint64_t w) { return w == 0; })) s.chunks.erase(it);
+}
+
+bool getSparseCell(const SparseLife& s, int64_t r, int64_t c) {
+    auto it = s.chunks.find(SparseLife::key(r >> 6, c >> 6));
+    return it != s.chunks.end() && ((it->second[r & 63] >> (c & 63)) & 1);
+}
+
+uint64_t sparsePopulation(const SparseLife& s) {
+    uint64_t total = 0;
+    for (const auto& entry : s.chunks)
+        for (uint64_t w : entry.second) total += __builtin_popcountll(w);
+    return total;
+}
+
+void sparseFromBitGrid(SparseLife& s, const BitGrid& g) {
+    s.chunks.clear();
+    s.generation = 0;
+    for (int r = 0; r < g.rows; ++r)
+        for (int c = 0; c < g.cols; ++c)
+            if (getBitCell(g, r, c)) setSparseCell(s, r, c, true);
+}
+
+// Копирует окно [0, rows) x [0, cols) плоскости в сетку
+void sparseToBitGrid(const SparseLife& s, BitGrid& g) {
+    fill(g.cur.begin(), g.cur.end(), 0);
+    for (const auto& entry : s.chunks) {
+        const int64_t r0 = SparseLife::keyY(entry.first) * 64, c0 = SparseLife::keyX(entry.first) * 64;
+        if (r0 >= g.rows || c0 >= g.cols || r0 + 64 <= 0 || c0 + 64 <= 0) continue;
+        for (int r = 0; r < 64; ++r) {
+            if (r0 + r < 0 || r0 + r >= g.rows) continue;
+            for (uint64_t w = entry.second[r]; w; w &= w - 1) {
+                const int64_t c = c0 + __builtin_ctzll(w);
+                if (c >= 0 && c < g.cols) setBitCell(g, (int)(r0 + r), (int)c, true);
+            }
+        }
+    }
+}
+
+// Правило B0 оживило бы всю бесконечную плоскость, поэтому запрещено
+void setSparseRule(SparseLife& s, const LifeRule& rule) {
+    if (rule.birth[0]) throw invalid_argument("Правила с B0 не поддерживаются на бесконечной плоскости");
+    s.kernel = lifeRuleKernel(rule);
 }
 
-// Эта функция используется для setupRandom в Игре Жизнь
-mt19937& getRandomEngine() {
-    static random_device rd;
-    static mt19937 genLife(rd());
-    return genLife;
+void stepSparseLife(SparseLife& s) {
+    // Кандидаты: все блоки и те соседи, к чьей стороне прижаты живые клетки
+    s.candidates.clear();
+    for (const auto& entry : s.chunks) {
+        const SparseLife::Chunk& ch = entry.second;
+        const int64_t cy = SparseLife::keyY(entry.first), cx = SparseLife::keyX(entry.first);
+        uint64_t columns = 0;
+        for (uint64_t w : ch) columns |= w;
+        const bool top = ch[0] != 0, bottom = ch[63] != 0;
+        const bool left = columns & 1, right = columns >> 63;
+        s.candidates.push_back(entry.first);
+        if (top) s.candidates.push_back(SparseLife::key(cy - 1, cx));
+        if (bottom) s.candidates.push_back(SparseLife::key(cy + 1, cx));
+        if (left) s.candidates.push_back(SparseLife::key(cy, cx - 1));
+        if (right) s.candidates.push_back(SparseLife::key(cy, cx + 1));
+        if (ch[0] & 1) s.candidates.push_back(SparseLife::key(cy - 1, cx - 1));
+        if (ch[0] >> 63) s.candidates.push_back(SparseLife::key(cy - 1, cx + 1));
+        if (ch[63] & 1) s.candidates.push_back(SparseLife::key(cy + 1, cx - 1));
+        if (ch[63] >> 63) s.candidates.push_back(SparseLife::key(cy + 1, cx + 1));
+    }
+    sort(s.candidates.begin(), s.candidates.end());
+    s.candidates.erase(unique(s.candidates.begin(), s.candidates.end()), s.candidates.end());
+
+    // Окрестность блока собирается в маленькое поле 66 строк x 3 слова,
+    // где средний столбец - сам блок, и считается тем же ядром, что и BitGrid
+    uint64_t local[66][3];
+    s.nextChunks.clear();
+    for (uint64_t k : s.candidates) {
+        const int64_t cy = SparseLife::keyY(k), cx = SparseLife::keyX(k);
+        const SparseLife::Chunk* around[3][3];
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                auto it = s.chunks.find(SparseLife::key(cy + dy, cx + dx));
+                around[dy + 1][dx + 1] = it == s.chunks.end() ? nullptr : &it->second;
+            }
+        }
+        for (int r = 0; r < 66; ++r) {
+            const int band = r == 0 ? 0 : (r == 65 ? 2 : 1);
+            const int inner = r == 0 ? 63 : (r == 65 ? 0 : r - 1);
+            for (int x = 0; x < 3; ++x) local[r][x] = around[band][x] ? (*around[band][x])[inner] : 0;
+        }
+        SparseLife::Chunk out;
+        uint64_t any = 0;
+        for (int r = 0; r < 64; ++r) {
+            s.kernel(&local[r][1], &local[r + 1][1], &local[r + 2][1], &out[r], 1, ~0ULL);
+            any |= out[r];
+        }
+        if (any) s.nextChunks.emplace(k, out);
+    }
+    s.chunks.swap(s.nextChunks);
+    ++s.generation;
 }
 
-void clearScreen() {
-    system("clear");
+// Движок для правил, которые не укладываются в битовые ядра: Generations
+// (больше двух состояний) и Larger than Life (радиус больше 1). Клетка - байт
+// с номером состояния. Живые клетки (состояние 1) считаются по префиксным
+// суммам, поэтому подсчет в окне любого радиуса стоит O(1) на клетку, а
+// переход - одно чтение из таблицы [состояние][число соседей] без ветвлений.
+struct ByteLife {
+    int rows = 0, cols = 0;
+    LifeRule rule;
+    vector<uint8_t> cur, next;
+    vector<uint8_t> table;    // states x (maxCount + 1)
+    vector<uint32_t> sums;    // (rows + 1) x (cols + 1): живые клетки выше и левее
+};
+
+ByteLife makeByteLife(int rows, int cols, const LifeRule& rule) {
+    if (rows <= 0 || cols <= 0) throw invalid_argument("Размер поля должен быть больше нуля");
+    ByteLife b;
+    b.rows = rows;
+    b.cols = cols;
+    b.rule = rule;
+    b.cur.assign((size_t)rows * cols, 0);
+    b.next.assign(b.cur.size(), 0);
+    b.sums.assign((size_t)(rows + 1) * (cols + 1), 0);
+    const int counts = rule.maxCount() + 1;
+    b.table.assign((size_t)rule.states * counts, 0);
+    for (int k = 0; k < counts; ++k) {
+        b.table[k] = rule.birth[k] ? 1 : 0;
+        // Не выжившая клетка Generations начинает угасать, двухцветная - умирает
+        b.table[counts + k] = rule.survive[k] ? 1 : (rule.states > 2 ? 2 : 0);
+        for (int s = 2; s < rule.states; ++s) b.table[(size_t)s * counts + k] = (s + 1 < rule.states) ? s + 1 : 0;
+    }
+    return b;
+}
+
+void byteLifeFromBitGrid(ByteLife& b, const BitGrid& g) {
+    for (int i = 0; i < b.rows; ++i)
+        for (int j = 0; j < b.cols; ++j)
+            b.cur[(size_t)i * b.cols + j] = (i < g.rows && j < g.cols && getBitCell(g, i, j)) ? 1 : 0;
+}
+
+// Живые - '0', угасающие - '.', мертвые - ' '
+void byteLifeToChars(const ByteLife& b, vector<vector<char>>& grid) {
+    for (int i = 0; i < b.rows; ++i)
+        for (int j = 0; j < b.cols; ++j) {
+            const uint8_t s = b.cur[(size_t)i * b.cols + j];
+            grid[i][j] = s == 1 ? '0' : (s == 0 ? ' ' : '.');
+        }
 }
 
-void sleepMilliseconds(int ms) {
-    this_thread::sleep_for(chrono::milliseconds(ms));
+uint64_t byteLifePopulation(const ByteLife& b) {
+    return count(b.cur.begin(), b.cur.end(), (uint8_t)1);
 }
 
-void displayGrid(const vector<vector<char>>& grid, int rows, int cols) {
+void stepByteLife(ByteLife& b) {
+    const int rows = b.rows, cols = b.cols, r = b.rule.radius, counts = b.rule.maxCount() + 1;
+    const size_t stride = cols + 1;
     for (int i = 0; i < rows; ++i) {
+        const uint8_t* row = &b.cur[(size_t)i * cols];
+        const uint32_t* above = &b.sums[(size_t)i * stride];
+        uint32_t* sum = &b.sums[(size_t)(i + 1) * stride];
+        uint32_t rowSum = 0;
         for (int j = 0; j < cols; ++j) {
-            cout << grid[i][j];
+            rowSum += row[j] == 1;
+            sum[j + 1] = above[j + 1] + rowSum;
         }
-        cout << endl;
     }
+    const uint8_t* table = b.table.data();
+    const uint32_t self = b.rule.includeCenter ? 0 : 1;
+    for (int i = 0; i < rows; ++i) {
+        const uint32_t* top = &b.sums[(size_t)max(0, i - r) * stride];
+        const uint32_t* bottom = &b.sums[(size_t)min(rows, i + r + 1) * stride];
+        const uint8_t* row = &b.cur[(size_t)i * cols];
+        uint8_t* out = &b.next[(size_t)i * cols];
+        for (int j = 0; j < cols; ++j) {
+            const int left = max(0, j - r), right = min(cols, j + r + 1);
+            const uint8_t state = row[j];
+            const uint32_t n = bottom[right] - bottom[left] - top[right] + top[left] - (state == 1 ? self : 0);
+            out[j] = table[(size_t)state * counts + n];
+        }
+    }
+    b.cur.swap(b.next);
 }
 
-int countLiveNeighbours(const vector<vector<char>>& grid, int r, int c, int rows, int cols) {
-    int count = 0;
-    for (int dr = -1; dr <= 1; ++dr) {
-        for (int dc = -1; dc <= 1; ++dc) {
-            if (dr == 0 && dc == 0) { // Пропускаем саму клетку
+// Чтение паттернов в форматах RLE (Golly, XLife) и plaintext (.cells).
+// Файл читается блоками по 1 МБ и разбирается посимвольно: строки поля не
+// собираются в промежуточные string, живые клетки отдаются отрезками
+// onRun(строка, столбец, длина). Для .cells размеры узнаются отдельным
+// проходом по файлу, так как заголовка у формата нет.
+class PatternReader {
+public:
+    long long width = 0, height = 0;
+    bool hasOffset = false;            // В файле есть #R/#P - левый верхний угол
+    long long offsetRow = 0, offsetCol = 0;
+    uint64_t generation = 0;           // Поколение из комментария снимка "#C generation N"
+    string rule = "B3/S23";
+
+    explicit PatternReader(const string& path) : file(fopen(path.c_str(), "rb"), fclose), buffer(1 << 20) {
+        if (!file) throw runtime_error("Не удалось открыть файл паттерна " + path);
+        const size_t dot = path.rfind('.');
+        const string ext = dot == string::npos ? "" : path.substr(dot);
+        if (ext == ".cells" || ext == ".txt") {
+            rle = false;
+        } else if (ext == ".rle") {
+            rle = true;
+        } else {
+            const int c = peek();
+            rle = c == '#' || c == 'x';
+        }
+        if (rle) {
+            readRleHeader();
+        } else {
+            measurePlaintext();
+            rewind(file.get());
+            pos = len = 0;
+        }
+    }
+
+    template <typename F>
+    void forEachRun(F&& onRun) {
+        if (rle) readRleBody(onRun);
+        else readPlaintextBody(onRun);
+    }
+
+private:
+    unique_ptr<FILE, int (*)(FILE*)> file;
+    vector<char> buffer;
+    size_t pos = 0, len = 0;
+    bool rle = true;
+
+    int peek() {
+        if (pos == len) {
+            len = fread(buffer.data(), 1, buffer.size(), file.get());
+            pos = 0;
+            if (len == 0) return EOF;
+        }
+        return (unsigned char)buffer[pos];
+    }
+
+    int get() {
+        const int c = peek();
+        if (c != EOF) ++pos;
+        return c;
+    }
+
+    void skipLine() {
+        for (int c = get(); c != EOF && c != '\n'; c = get()) {}
+    }
+
+    void skipSpaces() {
+        while (peek() == ' ' || peek() == '\t' || peek() == '\r') get();
+    }
+
+    bool readNumber(long long& value) {
+        skipSpaces();
+        bool negative = false;
+        if (peek() == '-') { negative = true; get(); }
+        if (!isdigit(peek())) return false;
+        value = 0;
+        while (isdigit(peek())) value = value * 10 + (get() - '0');
+        if (negative) value = -value;
+        return true;
+    }
+
+    bool readWord(const char* word) {
+        skipSpaces();
+        for (const char* w = word; *w; ++w)
+            if (peek() != *w) return false; else get();
+        return true;
+    }
+
+    // Комментарии "#..." и строка "x = 3, y = 3, rule = B3/S23"
+    void readRleHeader() {
+        while (true) {
+            skipSpaces();
+            const int c = peek();
+            if (c == '#') {
+                get();
+                const int type = get();
+                long long a, b;
+                if ((type == 'R' || type == 'P') && readNumber(a) && readNumber(b)) {
+                    hasOffset = true;
+                    offsetCol = a;
+                    offsetRow = b;
+                } else if ((type == 'C' || type == 'c') && readWord("generation") && readNumber(a)) {
+                    generation = (uint64_t)a;
+                }
+                skipLine();
+            } else if (c == '\n') {
+                get();
+            } else if (c == 'x') {
+                get();
+                if (!readWord("=") || !readNumber(width)) break;
+                if (!readWord(",") || !readWord("y") || !readWord("=") || !readNumber(height)) break;
+                if (readWord(",") && readWord("rule") && readWord("=")) {
+                    skipSpaces();
+                    rule.clear();
+                    while (peek() != EOF && peek() != '\n' && peek() != '\r' && peek() != ' ') rule += (char)get();
+                }
+                skipLine();
+                if (width < 0 || height < 0) break;
+                return;
+            } else {
+                break;
+            }
+        }
+        throw runtime_error("Некорректный заголовок RLE (ожидается x = ..., y = ...)");
+    }
+
+    // Многоцветный RLE: '.' - состояние 0, A..X - 1..24, префикс p..y
+    // добавляет по 24 (pA = 25). Живое только состояние 1; состояния от 2
+    // (в Generations - умирающие клетки) в двухцветное поле не переносятся,
+    // поэтому такой файл отвергается, а не читается с ошибочными клетками.
+    template <typename F>
+    void readRleBody(F& onRun) {
+        long long row = 0, col = 0, count = 0;
+        int prefix = 0; // Префикс p..y многобуквенного состояния: 1..10, 0 - нет
+        for (int c = get(); c != EOF && c != '!'; c = get()) {
+            if (isdigit(c)) {
+                count = count * 10 + (c - '0');
                 continue;
             }
-            int nr = r + dr; // Соседняя строка
-            int nc = c + dc; // Соседний столбец
+            const long long n = count == 0 ? 1 : count;
+            if (c == 'b' || c == '.') {
+                col += n;
+            } else if (c == 'o' || (c >= 'A' && c <= 'X')) {
+                const int state = c == 'o' ? 1 : prefix * 24 + (c - 'A' + 1);
+                if (state != 1)
+                    throw runtime_error("Многоцветный RLE не поддерживается: состояние " + to_string(state)
+                                        + " нельзя загрузить в поле с двумя состояниями");
+                onRun(row, col, n);
+                col += n;
+            } else if (c >= 'p' && c <= 'y') {
+                if (prefix != 0) throw runtime_error("Некорректное многобуквенное состояние RLE");
+                prefix = c - 'p' + 1;
+                continue; // Счетчик относится к следующей за префиксом букве
+            } else if (c == '$') {
+                row += n;
+                col = 0;
+            } else if (c == '#') {
+                skipLine();
+            } else if (!isspace(c)) {
+                throw runtime_error(string("Недопустимый символ в RLE: ") + (char)c);
+            }
+            if (prefix != 0 && !(c >= 'A' && c <= 'X')) throw runtime_error("Некорректное многобуквенное состояние RLE");
+            prefix = 0;
+            count = 0;
+        }
+    }
 
-            // Проверяем границы
-            if (nr >= 0 && nr < rows && nc >= 0 && nc < cols) {
-                if (grid[nr][nc] == '0') count++;
+    void measurePlaintext() {
+        long long row = 0, col = 0;
+        bool lineStart = true, comment = false;
+        for (int c = get(); c != EOF; c = get()) {
+            if (c == '\n') {
+                if (!comment) ++row;
+                col = 0;
+                lineStart = true;
+                comment = false;
+                continue;
             }
+            if (lineStart && c == '!') comment = true;
+            lineStart = false;
+            if (!comment && c != '\r') width = max(width, ++col);
         }
+        height = row + (col > 0 ? 1 : 0);
     }
-    return count;
+
+    template <typename F>
+    void readPlaintextBody(F& onRun) {
+        long long row = 0, col = 0, runStart = -1;
+        bool lineStart = true, comment = false;
+        for (int c = get();; c = get()) {
+            const bool alive = !comment && (c == 'O' || c == '*');
+            if (!alive && runStart >= 0) {
+                onRun(row, runStart, col - runStart);
+                runStart = -1;
+            }
+            if (c == EOF) break;
+            if (c == '\n') {
+                if (!comment) ++row;
+                col = 0;
+                lineStart = true;
+                comment = false;
+                continue;
+            }
+            if (lineStart && c == '!') comment = true;
+            lineStart = false;
+            if (comment || c == '\r') continue;
+            if (alive && runStart < 0) runStart = col;
+            ++col;
+        }
+    }
+};
+
+// Левый верхний угол паттерна на поле rows x cols: по #R из файла, если он
+// неотрицательный, иначе по центру поля. Снимки плоскости движки hashlife и
+// sparse читают не так, а через patternCells прямо в координатах #R.
+pair<long long, long long> patternPlacement(const PatternReader& reader, int rows, int cols) {
+    if (reader.hasOffset && reader.offsetRow >= 0 && reader.offsetCol >= 0) return {reader.offsetRow, reader.offsetCol};
+    return {max(0LL, (rows - reader.height) / 2), max(0LL, (cols - reader.width) / 2)};
 }
 
-void calculateNextGeneration(vector<vector<char>>& grid, int rows, int cols) {
-    vector<vector<char>> nextGrid = grid; // Создаем копию текущего состояния для вычислений
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            int liveNeighbours = countLiveNeighbours(grid, i, j, rows, cols);
-            char currentCellState = grid[i][j];
+// Загрузка в битовое поле; клетки за пределами поля отбрасываются
+void loadPattern(PatternReader& reader, BitGrid& g, long long originRow, long long originCol) {
+    fill(g.cur.begin(), g.cur.end(), 0);
+    reader.forEachRun([&](long long row, long long col, long long length) {
+        const long long r = originRow + row;
+        if (r < 0 || r >= g.rows) return;
+        for (long long c = max(0LL, originCol + col); c < min<long long>(g.cols, originCol + col + length); ++c)
+            setBitCell(g, (int)r, (int)c, true);
+    });
+}
 
-            if (currentCellState == '0') { // Если клетка жива
-                // Правила для живой клетки
-                if (liveNeighbours < 2 || liveNeighbours > 3) {
-                    nextGrid[i][j] = ' '; // Умирает от одиночества или перенаселения
+// Живые клетки паттерна в координатах плоскости, угол паттерна - (originRow, originCol)
+vector<pair<long long, long long>> patternCells(PatternReader& reader, long long originRow, long long originCol) {
+    vector<pair<long long, long long>> cells;
+    reader.forEachRun([&](long long row, long long col, long long length) {
+        for (long long i = 0; i < length; ++i) cells.push_back({originRow + row, originCol + col + i});
+    });
+    return cells;
+}
+
+// Живые клетки битового поля в порядке строк
+vector<pair<long long, long long>> liveCells(const BitGrid& g) {
+    vector<pair<long long, long long>> cells;
+    for (int r = 0; r < g.rows; ++r) {
+        const uint64_t* row = g.row(g.cur, r);
+        for (int w = 0; w < g.words; ++w)
+            for (uint64_t bits = row[w]; bits; bits &= bits - 1)
+                cells.push_back({r, w * 64 + __builtin_ctzll(bits)});
+    }
+    return cells;
+}
+
+vector<pair<long long, long long>> liveCells(const SparseLife& s) {
+    vector<pair<long long, long long>> cells;
+    for (const auto& entry : s.chunks) {
+        const long long r0 = SparseLife::keyY(entry.first) * 64, c0 = SparseLife::keyX(entry.first) * 64;
+        for (int r = 0; r < 64; ++r)
+            for (uint64_t bits = entry.second[r]; bits; bits &= bits - 1)
+                cells.push_back({r0 + r, c0 + __builtin_ctzll(bits)});
+    }
+    sort(cells.begin(), cells.end());
+    return cells;
+}
+
+vector<pair<long long, long long>> liveCells(const HashLife& h) {
+    vector<pair<long long, long long>> cells;
+    h.forEachLiveCell([&](long long r, long long c) { cells.push_back({r, c}); });
+    sort(cells.begin(), cells.end());
+    return cells;
+}
+
+// Снимок в RLE. cells - живые клетки в порядке строк. Для ограниченного поля
+// передаются его размеры, для плоскости (height = width = 0) берется
+// ограничивающий прямоугольник, а его угол записывается в #R.
+// Поколение сохраняется комментарием, по нему счет продолжается после загрузки.
+void writeRleSnapshot(const string& path, const vector<pair<long long, long long>>& cells, uint64_t generation,
+                      long long height = 0, long long width = 0, const string& rule = "B3/S23") {
+    long long top = 0, left = 0;
+    if (height == 0 && !cells.empty()) {
+        long long right = cells.front().second;
+        top = cells.front().first;
+        left = cells.front().second;
+        for (const auto& cell : cells) {
+            left = min(left, cell.second);
+            right = max(right, cell.second);
+        }
+        height = cells.back().first - top + 1;
+        width = right - left + 1;
+    }
+
+    string out;
+    out.reserve(cells.size() * 3 + 128);
+    out += "#C generation " + to_string(generation) + "\n";
+    out += "#R " + to_string(left) + " " + to_string(top) + "\n";
+    out += "x = " + to_string(width) + ", y = " + to_string(height) + ", rule = " + rule + "\n";
+
+    size_t lineStart = out.size();
+    auto token = [&](long long count, char tag) {
+        string t = count > 1 ? to_string(count) : string();
+        t += tag;
+        if (out.size() - lineStart + t.size() > 70) {
+            out += '\n';
+            lineStart = out.size();
+        }
+        out += t;
+    };
+
+    long long row = top, col = left;
+    for (size_t i = 0; i < cells.size();) {
+        const long long r = cells[i].first;
+        long long c = cells[i].second;
+        long long run = 1;
+        while (i + run < cells.size() && cells[i + run].first == r && cells[i + run].second == c + run) ++run;
+        if (r > row) {
+            token(r - row, '$');
+            row = r;
+            col = left;
+        }
+        if (c > col) token(c - col, 'b');
+        token(run, 'o');
+        col = c + run;
+        i += run;
+    }
+    out += "!\n";
+
+    unique_ptr<FILE, int (*)(FILE*)> file(fopen(path.c_str(), "wb"), fclose);
+    if (!file || fwrite(out.data(), 1, out.size(), file.get()) != out.size())
+        throw runtime_error("Не удалось записать снимок " + path);
+}
+
+// Сверка битовых ядер с классическим calculateNextGeneration на случайных полях.
+// Размеры не кратны 64, граничные строки и столбцы заполнены гуще, чтобы
+// проверить обработку краев.
+bool checkLifeKernels(int boards = 200, int generationsPerBoard = 16) {
+    vector<LifeKernel> kernels = {{"скалярное", stepBitRow, LifeISA::Scalar}};
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) kernels.push_back({"SSE2", stepBitRowSSE2, LifeISA::SSE2});
+    if (__builtin_cpu_supports("avx2")) kernels.push_back({"AVX2", stepBitRowAVX2, LifeISA::AVX2});
+#endif
+    mt19937 gen(12345);
+    bool ok = true;
+    for (const LifeKernel& kernel : kernels) {
+        int failures = 0;
+        for (int b = 0; b < boards && failures == 0; ++b) {
+            const int rows = 1 + gen() % 80, cols = 1 + gen() % 600;
+            vector<vector<char>> grid(rows, vector<char>(cols, ' '));
+            for (int i = 0; i < rows; ++i) {
+                for (int j = 0; j < cols; ++j) {
+                    const bool border = i == 0 || j == 0 || i == rows - 1 || j == cols - 1;
+                    grid[i][j] = (gen() % (border ? 2 : 4) == 0) ? '0' : ' ';
+                }
+            }
+            BitGrid bitGrid = makeBitGrid(rows, cols);
+            bitGridFromChars(bitGrid, grid);
+            vector<vector<char>> result(rows, vector<char>(cols));
+            for (int g = 0; g < generationsPerBoard; ++g) {
+                calculateNextGeneration(grid, rows, cols);
+                stepBitGrid(bitGrid, kernel.step);
+                bitGridToChars(bitGrid, result);
+                if (result != grid) {
+                    cout << "Ядро " << kernel.name << ": расхождение на поле " << rows << "x" << cols
+                         << ", поколение " << g + 1 << endl;
+                    ++failures;
+                    break;
                 }
-                // Если соседей 2 или 3, остается живой (ничего не меняем в nextGrid)
-            } else { // Если клетка мертва (' ')
-                // Правила для мертвой клетки
-                if (liveNeighbours == 3) nextGrid[i][j] = '0';
             }
         }
+        cout << "Ядро " << kernel.name << ": " << (failures == 0 ? "OK" : "ОШИБКА") << endl;
+        ok = ok && failures == 0;
     }
-    grid = nextGrid; // Обновляем основную сетку новым поколением
+
+    // Многопоточный шаг должен совпадать с последовательным бит в бит
+    int parallelFailures = 0;
+    for (int b = 0; b < boards / 4 && parallelFailures == 0; ++b) {
+        const int rows = 1 + gen() % 120, cols = 1 + gen() % 400, threads = 1 + gen() % 9;
+        BitGrid serial = makeBitGrid(rows, cols);
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < cols; ++j)
+                setBitCell(serial, i, j, gen() % 3 == 0);
+        BitGrid parallel = serial;
+        for (int g = 0; g < generationsPerBoard; ++g) stepBitGrid(serial, activeLifeKernel().step);
+        stepBitGridParallel(parallel, generationsPerBoard, threads);
+        if (serial.cur != parallel.cur) {
+            cout << "Многопоточный шаг: расхождение на поле " << rows << "x" << cols << ", потоков " << threads << endl;
+            ++parallelFailures;
+        }
+    }
+    cout << "Многопоточный шаг: " << (parallelFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // HashLife на бесконечной плоскости совпадает с ограниченным полем,
+    // пока паттерн не дошел до края: поле берется с запасом в 64 клетки
+    int hashLifeFailures = 0;
+    for (int b = 0; b < boards / 20 && hashLifeFailures == 0; ++b) {
+        const int rows = 160, cols = 200;
+        BitGrid reference = makeBitGrid(rows, cols);
+        for (int i = 64; i < rows - 64; ++i)
+            for (int j = 64; j < cols - 64; ++j)
+                setBitCell(reference, i, j, gen() % 3 == 0);
+        HashLife hashLife(1 << 14); // Маленький лимит, чтобы задействовать сборку мусора
+        hashLife.loadFromBitGrid(reference);
+        BitGrid result = makeBitGrid(rows, cols);
+        for (int k = 0; k <= 5 && hashLifeFailures == 0; ++k) {
+            // Прыжки 1, 2, 4, ..., 32: всего 63 поколения
+            for (int g = 0; g < (1 << k); ++g) stepBitGrid(reference);
+            hashLife.advancePow2(k);
+            hashLife.copyToBitGrid(result);
+            if (result.cur != reference.cur) {
+                cout << "HashLife: расхождение после прыжка на 2^" << k << endl;
+                ++hashLifeFailures;
+            }
+        }
+    }
+    // Растущий Switch Engine одним прыжком на 2^12 поколений: с маленьким
+    // лимитом прыжок дробится, но число узлов не выходит за лимит, а
+    // результат тот же. Лимит, в который паттерн не помещается, дает ошибку.
+    {
+        HashLife bounded(1 << 12), unbounded(1 << 22);
+        HashLife tiny(48), mixed(1 << 22);
+        BitGrid start = makeBitGrid(8, 8);
+        for (const auto& p : switchEnginePattern()) setBitCell(start, p.first, p.second, true);
+        bounded.loadFromBitGrid(start);
+        unbounded.loadFromBitGrid(start);
+        tiny.loadFromBitGrid(start);
+        mixed.loadFromBitGrid(start);
+        bounded.advancePow2(12);
+        unbounded.advancePow2(12);
+        // 4095 = 2^0 + ... + 2^11: шаг меняется на каждом прыжке, кеш результатов переиспользуется
+        mixed.advance(4095);
+        mixed.advancePow2(0);
+        if (liveCells(bounded) != liveCells(unbounded) || liveCells(mixed) != liveCells(unbounded) || bounded.generation() != 4096 || bounded.nodeCount() > bounded.nodeLimit()) {
+            cout << "HashLife: прыжок с лимитом узлов расходится с прыжком без лимита" << endl;
+            ++hashLifeFailures;
+        }
+        bool rejected = false;
+        try {
+            tiny.advancePow2(12);
+        } catch (const runtime_error&) {
+            rejected = true;
+        }
+        if (!rejected || tiny.nodeCount() > tiny.nodeLimit()) {
+            cout << "HashLife: превышение лимита узлов не обнаружено" << endl;
+            ++hashLifeFailures;
+        }
+    }
+    cout << "HashLife: " << (hashLifeFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // Плиточный движок: поле заполнено редкими пятнами, чтобы часть плиток
+    // засыпала и просыпалась, когда к ней подходит активность соседей
+    int tiledFailures = 0;
+    for (int b = 0; b < boards / 10 && tiledFailures == 0; ++b) {
+        const int rows = 1 + gen() % 300, cols = 1 + gen() % 500;
+        BitGrid reference = makeBitGrid(rows, cols);
+        for (int spot = 0; spot < 6; ++spot) {
+            const int r0 = gen() % rows, c0 = gen() % cols;
+            for (int i = r0; i < min(rows, r0 + 12); ++i)
+                for (int j = c0; j < min(cols, c0 + 12); ++j)
+                    setBitCell(reference, i, j, gen() % 2 == 0);
+        }
+        TiledLife tiled = makeTiledLife(reference);
+        for (int g = 0; g < generationsPerBoard * 4; ++g) {
+            stepBitGrid(reference);
+            stepTiledLife(tiled);
+            if (tiled.grid.cur != reference.cur) {
+                cout << "Плиточный движок: расхождение на поле " << rows << "x" << cols << ", поколение " << g + 1 << endl;
+                ++tiledFailures;
+                break;
+            }
+        }
+    }
+    cout << "Плиточный движок: " << (tiledFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // Тор сверяется с прямым подсчетом соседей по модулю размеров
+    int torusFailures = 0;
+    for (int b = 0; b < boards / 4 && torusFailures == 0; ++b) {
+        const int rows = 1 + gen() % 70, cols = 1 + gen() % 200;
+        vector<vector<char>> grid(rows, vector<char>(cols, ' '));
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < cols; ++j)
+                grid[i][j] = (gen() % 3 == 0) ? '0' : ' ';
+        BitGrid torus = makeBitGrid(rows, cols);
+        bitGridFromChars(torus, grid);
+        vector<vector<char>> result(rows, vector<char>(cols));
+        for (int g = 0; g < generationsPerBoard && torusFailures == 0; ++g) {
+            vector<vector<char>> next = grid;
+            for (int i = 0; i < rows; ++i) {
+                for (int j = 0; j < cols; ++j) {
+                    int neighbours = 0;
+                    for (int dr = -1; dr <= 1; ++dr)
+                        for (int dc = -1; dc <= 1; ++dc)
+                            if ((dr != 0 || dc != 0) && grid[(i + dr + rows) % rows][(j + dc + cols) % cols] == '0') ++neighbours;
+                    next[i][j] = (neighbours == 3 || (neighbours == 2 && grid[i][j] == '0')) ? '0' : ' ';
+                }
+            }
+            grid.swap(next);
+            stepBitGridTorus(torus, activeLifeKernel().step);
+            bitGridToChars(torus, result);
+            if (result != grid) {
+                cout << "Тор: расхождение на поле " << rows << "x" << cols << ", поколение " << g + 1 << endl;
+                ++torusFailures;
+            }
+        }
+    }
+    cout << "Тор: " << (torusFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // Бесконечная плоскость: паттерн сдвинут в отрицательные координаты,
+    // чтобы проверить блоки по обе стороны от нуля, и сверяется с полем с запасом
+    int sparseFailures = 0;
+    for (int b = 0; b < boards / 20 && sparseFailures == 0; ++b) {
+        const int rows = 260, cols = 300, margin = 100, shift = 130;
+        BitGrid reference = makeBitGrid(rows, cols);
+        for (int i = margin; i < rows - margin; ++i)
+            for (int j = margin; j < cols - margin; ++j)
+                setBitCell(reference, i, j, gen() % 3 == 0);
+        SparseLife sparse;
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < cols; ++j)
+                if (getBitCell(reference, i, j)) setSparseCell(sparse, i - shift, j - shift, true);
+        for (int g = 0; g < generationsPerBoard * 4 && sparseFailures == 0; ++g) {
+            stepBitGrid(reference);
+            stepSparseLife(sparse);
+            bool same = sparsePopulation(sparse) == accumulate(reference.cur.begin(), reference.cur.end(), 0ULL,
+                [](uint64_t acc, uint64_t w) { return acc + __builtin_popcountll(w); });
+            for (int i = 0; i < rows && same; ++i)
+                for (int j = 0; j < cols && same; ++j)
+                    same = getSparseCell(sparse, i - shift, j - shift) == getBitCell(reference, i, j);
+            if (!same) {
+                cout << "Бесконечная плоскость: расхождение в поколении " << g + 1 << endl;
+                ++sparseFailures;
+            }
+        }
+    }
+    // Одинокий планер не должен тащить за собой пустые блоки
+    SparseLife glider;
+    for (const auto& p : vector<pair<int, int>>{{0, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}}) setSparseCell(glider, p.first, p.second, true);
+    for (int g = 0; g < 4000 && sparseFailures == 0; ++g) {
+        stepSparseLife(glider);
+        if (glider.chunks.size() > 4 || sparsePopulation(glider) != 5) {
+            cout << "Бесконечная плоскость: планер оставил лишние блоки в поколении " << g + 1 << endl;
+            ++sparseFailures;
+        }
+    }
+    cout << "Бесконечная плоскость: " << (sparseFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // RLE: снимок случайного поля читается обратно без потерь, а разбор
+    // понимает счетчики, пустые строки, комментарии и формат .cells
+    int patternFailures = 0;
+    const string snapshotPath = "life_check_snapshot.rle", cellsPath = "life_check_pattern.cells";
+    for (int b = 0; b < boards / 20 && patternFailures == 0; ++b) {
+        const int rows = 1 + gen() % 150, cols = 1 + gen() % 300;
+        BitGrid original = makeBitGrid(rows, cols);
+        for (int i = 0; i < rows; ++i)
+            for (int j = 0; j < cols; ++j)
+                setBitCell(original, i, j, gen() % (i % 7 == 0 ? 50 : 3) == 0);
+        writeRleSnapshot(snapshotPath, liveCells(original), 1000 + b, rows, cols);
+        PatternReader reader(snapshotPath);
+        BitGrid loaded = makeBitGrid(rows, cols);
+        loadPattern(reader, loaded, reader.offsetRow, reader.offsetCol);
+        if (loaded.cur != original.cur || reader.generation != (uint64_t)(1000 + b) || reader.width != cols || reader.height != rows) {
+            cout << "RLE: снимок поля " << rows << "x" << cols << " не совпал после чтения" << endl;
+            ++patternFailures;
+        }
+    }
+    {
+        FILE* f = fopen(snapshotPath.c_str(), "wb");
+        fputs("#N Glider pair\n#C comment\nx = 5, y = 6, rule = B3/S23\nbo$2bo$3o2$\n2b3o$2bo!\n", f);
+        fclose(f);
+        f = fopen(cellsPath.c_str(), "wb");
+        fputs("!Name: Glider pair\r\n.O\r\n..O\r\nOOO\r\n\r\n..OOO\r\n..O\r\n", f);
+        fclose(f);
+        const vector<pair<long long, long long>> expected = {{0, 1}, {1, 2}, {2, 0}, {2, 1}, {2, 2}, {4, 2}, {4, 3}, {4, 4}, {5, 2}};
+        for (const string& path : {snapshotPath, cellsPath}) {
+            PatternReader reader(path);
+            BitGrid loaded = makeBitGrid(8, 8);
+            loadPattern(reader, loaded, 0, 0);
+            if (liveCells(loaded) != expected || reader.width != 5 || reader.height != 6) {
+                cout << "Разбор паттерна " << path << ": неверные клетки" << endl;
+                ++patternFailures;
+            }
+        }
+        // Многоцветный RLE: A - живая клетка, умирающие B и pA отвергаются
+        const char* multiState[] = {"x = 3, y = 2, rule = 23/3/3\n.A$2A.!\n", "x = 3, y = 2, rule = 23/3/3\n.A$AB.!\n",
+                                    "x = 3, y = 2, rule = 23/3/3\n.A$pA!\n"};
+        for (int i = 0; i < 3; ++i) {
+            f = fopen(snapshotPath.c_str(), "wb");
+            fputs(multiState[i], f);
+            fclose(f);
+            PatternReader reader(snapshotPath);
+            BitGrid loaded = makeBitGrid(4, 4);
+            bool rejected = false;
+            try {
+                loadPattern(reader, loaded, 0, 0);
+            } catch (const runtime_error&) {
+                rejected = true;
+            }
+            const vector<pair<long long, long long>> alive = {{0, 1}, {1, 0}, {1, 1}};
+            if (i == 0 ? rejected || liveCells(loaded) != alive : !rejected) {
+                cout << "Разбор многоцветного RLE: неверная обработка состояний (случай " << i << ")" << endl;
+                ++patternFailures;
+            }
+        }
+    }
+    remove(snapshotPath.c_str());
+    remove(cellsPath.c_str());
+    cout << "RLE и .cells: " << (patternFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // Правила: битовые ядра (специализированные и табличное) сверяются с
+    // байтовым движком, а он - с прямым подсчетом соседей в окне радиуса R
+    int ruleFailures = 0;
+    if (parseLifeRule("23/3").name != "B3/S23" || parseLifeRule("b36/s23").name != "B36/S23" || parseLifeRule("/2/3").name != "B2/S/C3") {
+        cout << "Разбор правил: неверная нормализация" << endl;
+        ++ruleFailures;
+    }
+    for (const char* text : {"B3/S23/256", "R1,C256,M0,S2..3,B3..3,NM"}) {
+        bool rejected = false;
+        try {
+            parseLifeRule(text);
+        } catch (const invalid_argument&) {
+            rejected = true;
+        }
+        if (!rejected) {
+            cout << "Разбор правил: принято правило с числом состояний больше 255: " << text << endl;
+            ++ruleFailures;
+        }
+    }
+    const vector<string> bitRules = {"B3/S23", "B36/S23", "B3678/S34678", "B2/S", "B368/S245",
+                                     "B0123478/S01234678", "B25/S4", "B/S012345678", "B08/S8"};
+    // Ядра всех правил строятся заранее: ядро не должно зависеть от того,
+    // какое правило собирали после него
+    vector<array<BitRowKernel, 2>> ruleKernelsBuilt;
+    for (const string& text : bitRules)
+        ruleKernelsBuilt.push_back({lifeRuleKernel(parseLifeRule(text), false), lifeRuleKernel(parseLifeRule(text), true)});
+    for (size_t k = 0; k < bitRules.size(); ++k) {
+        const LifeRule rule = parseLifeRule(bitRules[k]);
+        for (const bool simd : {false, true}) {
+            const BitRowKernel& kernel = ruleKernelsBuilt[k][simd];
+            for (int b = 0; b < boards / 40 && ruleFailures == 0; ++b) {
+                const int rows = 1 + gen() % 60, cols = 1 + gen() % 300;
+                BitGrid bits = makeBitGrid(rows, cols);
+                for (int i = 0; i < rows; ++i)
+                    for (int j = 0; j < cols; ++j)
+                        setBitCell(bits, i, j, gen() % 3 == 0);
+                ByteLife bytes = makeByteLife(rows, cols, rule);
+                byteLifeFromBitGrid(bytes, bits);
+                for (int g = 0; g < generationsPerBoard && ruleFailures == 0; ++g) {
+                    stepBitGrid(bits, kernel);
+                    stepByteLife(bytes);
+                    for (int i = 0; i < rows && ruleFailures == 0; ++i)
+                        for (int j = 0; j < cols && ruleFailures == 0; ++j)
+                            if (getBitCell(bits, i, j) != (bytes.cur[(size_t)i * cols + j] == 1)) {
+                                cout << "Правило " << rule.name << (simd ? " (SIMD)" : "") << ": расхождение на поле "
+                                     << rows << "x" << cols << ", поколение " << g + 1 << endl;
+                                ++ruleFailures;
+                            }
+                }
+            }
+        }
+    }
+    const vector<string> byteRules = {"B2/S/C3", "345/2/4", "R2,C0,M1,S3..5,B3..4,NM", "R3,C4,M0,S10..20,B8..12,NM"};
+    for (const string& text : byteRules) {
+        const LifeRule rule = parseLifeRule(text);
+        for (int b = 0; b < boards / 40 && ruleFailures == 0; ++b) {
+            const int rows = 1 + gen() % 50, cols = 1 + gen() % 80;
+            ByteLife bytes = makeByteLife(rows, cols, rule);
+            for (uint8_t& cell : bytes.cur) cell = gen() % rule.states;
+            vector<uint8_t> expected(bytes.cur.size());
+            for (int g = 0; g < generationsPerBoard && ruleFailures == 0; ++g) {
+                for (int i = 0; i < rows; ++i) {
+                    for (int j = 0; j < cols; ++j) {
+                        int neighbours = 0;
+                        for (int di = -rule.radius; di <= rule.radius; ++di)
+                            for (int dj = -rule.radius; dj <= rule.radius; ++dj) {
+                                const int ni = i + di, nj = j + dj;
+                                if ((di != 0 || dj != 0 || rule.includeCenter) && ni >= 0 && ni < rows && nj >= 0 && nj < cols)
+                                    neighbours += bytes.cur[(size_t)ni * cols + nj] == 1;
+                            }
+                        const uint8_t state = bytes.cur[(size_t)i * cols + j];
+                        uint8_t next;
+                        if (state == 0) next = rule.birth[neighbours] ? 1 : 0;
+                        else if (state == 1) next = rule.survive[neighbours] ? 1 : (rule.states > 2 ? 2 : 0);
+                        else next = state + 1 < rule.states ? state + 1 : 0;
+                        expected[(size_t)i * cols + j] = next;
+                    }
+                }
+                stepByteLife(bytes);
+                if (bytes.cur != expected) {
+                    cout << "Правило " << rule.name << ": расхождение на поле " << rows << "x" << cols << ", поколение " << g + 1 << endl;
+                    ++ruleFailures;
+                }
+            }
+        }
+    }
+    cout << "Правила B/S, Generations, Larger than Life: " << (ruleFailures == 0 ? "OK" : "ОШИБКА") << endl;
+    return ok && parallelFailures == 0 && hashLifeFailures == 0 && tiledFailures == 0 && torusFailures == 0 && sparseFailures == 0
+        && patternFailures == 0 && ruleFailures == 0;
 }
 
-void setupRandom(vector<vector<char>>& grid, int rows, int cols) {
-    uniform_int_distribution<int> dist(0, 3); // 25% клеток будут живыми
-    for (int i = 0; i < rows; ++i) {
-        for (int j = 0; j < cols; ++j) {
-            grid[i][j] = (dist(getRandomEngine()) == 0) ? '0' : ' ';
+// Пакетный режим: поле, число поколений, зерно, паттерн и движок задаются
+// аргументами командной строки, на экран ничего не выводится. Замеряется
+// только счет поколений, без подготовки поля.
+struct LifeBatchConfig {
+    int rows = 1024, cols = 1024;
+    long long generations = 1000;
+    uint64_t seed = 42;
+    string pattern = "random";  // random | switch | путь к файлу .rle/.cells
+    string engine = "simd";     // classic | bit | simd | parallel | hashlife | tiled | torus | sparse | multistate
+    string rule;                // Пусто - B3/S23 или правило из файла паттерна
+    int threads = 0;            // 0 - по числу ядер
+    long long snapshotEvery = 0;          // Снимок RLE каждые N поколений, 0 - без снимков
+    string snapshotPrefix = "life_snapshot"; // Снимки пишутся в <prefix>_<поколение>.rle
+};
+
+struct LifeBatchResult {
+    double seconds = 0;
+    uint64_t population = 0;
+    uint64_t startGeneration = 0; // Поколение загруженного снимка
+    string rule;
+    int rows = 0, cols = 0;
+    double generationsPerSecond() const { return seconds > 0 ? generationsDone / seconds : 0; }
+    double cellUpdatesPerSecond() const { return generationsPerSecond() * cellsPerGeneration; }
+    double generationsDone = 0;
+    double cellsPerGeneration = 0;
+};
+
+const vector<string>& lifeEngineNames() {
+    static const vector<string> names = {"classic", "bit", "simd", "parallel", "hashlife", "tiled", "torus", "sparse", "multistate"};
+    return names;
+}
+
+// Случайное поле с плотностью 25%, как в setupRandom, но воспроизводимое по зерну:
+// AND двух случайных слов оставляет каждый бит с вероятностью 1/4. Строка r -
+// поток Philox с номером r, так что поле не зависит от числа потоков.
+void setupRandomBitGrid(BitGrid& g, uint64_t seed, int threads = 0) {
+    if (threads <= 0) threads = threadsForWork((size_t)g.rows * g.words * 64);
+    fill(g.cur.begin(), g.cur.end(), 0);
+    forEachRowBand(g.rows, threads, [&](int from, int to) {
+        vector<uint64_t> words(2 * (size_t)g.words);
+        for (int r = from; r < to; ++r) {
+            Philox4x32 engine(seed, (uint64_t)r);
+            engine.generate(words.data(), words.size());
+            uint64_t* row = g.row(g.cur, r);
+            for (int w = 0; w < g.words; ++w) row[w] = words[2 * w] & words[2 * w + 1];
+            row[g.words - 1] &= g.tailMask;
+        }
+    });
+}
+
+LifeBatchResult runLifeBatch(const LifeBatchConfig& config) {
+    const vector<string>& names = lifeEngineNames();
+    if (find(names.begin(), names.end(), config.engine) == names.end())
+        throw invalid_argument("Неизвестный движок: " + config.engine);
+    if (config.generations <= 0) throw invalid_argument("Количество поколений должно быть положительным числом.");
+    if (config.snapshotEvery < 0) throw invalid_argument("Период снимков не может быть отрицательным.");
+
+    LifeBatchResult result;
+    BitGrid grid;
+    vector<pair<long long, long long>> planeCells; // Паттерн движка плоскости в координатах #R
+    bool planePattern = false;
+    string ruleText = config.rule.empty() ? "B3/S23" : config.rule;
+    if (config.pattern == "random") {
+        grid = makeBitGrid(config.rows, config.cols);
+        setupRandomBitGrid(grid, config.seed);
+    } else if (config.pattern == "switch") {
+        grid = makeBitGrid(config.rows, config.cols);
+        // Паттерн в центре, чтобы ему было куда расти
+        for (const auto& p : switchEnginePattern()) {
+            const int r = config.rows / 2 + p.first, c = config.cols / 2 + p.second;
+            if (r < config.rows && c < config.cols) setBitCell(grid, r, c, true);
+        }
+    } else {
+        // Любое другое значение - путь к файлу RLE или .cells; поле
+        // расширяется, чтобы паттерн поместился целиком
+        PatternReader reader(config.pattern);
+        long long rows = max<long long>(config.rows, reader.height), cols = max<long long>(config.cols, reader.width);
+        if (reader.hasOffset && reader.offsetRow >= 0 && reader.offsetCol >= 0) {
+            rows = max(rows, reader.offsetRow + reader.height);
+            cols = max(cols, reader.offsetCol + reader.width);
+        }
+        if (rows > numeric_limits<int>::max() || cols > numeric_limits<int>::max())
+            throw invalid_argument("Паттерн слишком велик для поля");
+        grid = makeBitGrid((int)rows, (int)cols);
+        // У hashlife и sparse координаты плоскости отсчитываются от угла
+        // исходного поля, и #R их снимка часто отрицательный. Такой снимок
+        // загружается в плоскость как есть, иначе продолжение счета сдвинется.
+        planePattern = reader.hasOffset && (config.engine == "hashlife" || config.engine == "sparse");
+        if (planePattern) {
+            planeCells = patternCells(reader, reader.offsetRow, reader.offsetCol);
+        } else {
+            const auto origin = patternPlacement(reader, grid.rows, grid.cols);
+            loadPattern(reader, grid, origin.first, origin.second);
+        }
+        result.startGeneration = reader.generation;
+        if (config.rule.empty()) ruleText = reader.rule; // Правило из заголовка файла
+    }
+
+    const LifeRule rule = parseLifeRule(ruleText);
+    result.rule = rule.name;
+    if (config.engine == "classic" && rule.name != "B3/S23")
+        throw invalid_argument("Классический движок считает только B3/S23");
+    if (config.engine != "multistate" && !rule.isLifeLike())
+        throw invalid_argument("Правило " + rule.name + " считается только движком multistate");
+    if (config.engine == "multistate" && config.snapshotEvery > 0)
+        throw invalid_argument("Снимки RLE для движка multistate не поддерживаются");
+    const BitRowKernel kernel = rule.isLifeLike() ? lifeRuleKernel(rule, config.engine != "bit") : stepBitRow;
+
+    result.rows = grid.rows;
+    result.cols = grid.cols;
+    result.generationsDone = (double)config.generations;
+    result.cellsPerGeneration = (double)grid.rows * grid.cols;
+    auto popcount = [](const vector<uint64_t>& buf) {
+        return accumulate(buf.begin(), buf.end(), 0ULL, [](uint64_t acc, uint64_t w) { return acc + __builtin_popcountll(w); });
+    };
+
+    // Поколения считаются отрезками до очередного снимка; запись снимков
+    // в замер времени не входит
+    using Clock = chrono::steady_clock;
+    auto run = [&](auto step, auto snapshot) {
+        uint64_t generation = result.startGeneration;
+        long long left = config.generations;
+        while (left > 0) {
+            long long count = left;
+            if (config.snapshotEvery > 0) count = min<long long>(count, config.snapshotEvery - (long long)(generation % config.snapshotEvery));
+            const auto start = Clock::now();
+            step(count);
+            result.seconds += chrono::duration<double>(Clock::now() - start).count();
+            generation += count;
+            left -= count;
+            if (config.snapshotEvery > 0 && generation % config.snapshotEvery == 0)
+                snapshot(config.snapshotPrefix + "_" + to_string(generation) + ".rle", generation);
+        }
+    };
+    auto gridSnapshot = [&](const BitGrid& g) {
+        return [&](const string& path, uint64_t generation) { writeRleSnapshot(path, liveCells(g), generation, g.rows, g.cols, rule.name); };
+    };
+
+    if (config.engine == "classic") {
+        vector<vector<char>> chars(grid.rows, vector<char>(grid.cols));
+        bitGridToChars(grid, chars);
+        run([&](long long count) { for (long long g = 0; g < count; ++g) calculateNextGeneration(chars, grid.rows, grid.cols); },
+            [&](const string& path, uint64_t generation) {
+                bitGridFromChars(grid, chars);
+                writeRleSnapshot(path, liveCells(grid), generation, grid.rows, grid.cols, rule.name);
+            });
+        bitGridFromChars(grid, chars);
+        result.population = popcount(grid.cur);
+    } else if (config.engine == "hashlife") {
+        // Прыжки по степеням двойки: "обновлений клеток" здесь нет, а скорость
+        // указывается в пересчете на исходное поле
+        HashLife hashLife(1 << 22, rule);
+        if (planePattern) hashLife.loadCells(planeCells);
+        else hashLife.loadFromBitGrid(grid);
+        run([&](long long count) { hashLife.advance((uint64_t)count); },
+            [&](const string& path, uint64_t generation) { writeRleSnapshot(path, liveCells(hashLife), generation, 0, 0, rule.name); });
+        result.population = hashLife.population();
+    } else if (config.engine == "sparse") {
+        SparseLife sparse;
+        setSparseRule(sparse, rule);
+        if (planePattern) {
+            for (const auto& cell : planeCells) setSparseCell(sparse, cell.first, cell.second, true);
+        } else {
+            sparseFromBitGrid(sparse, grid);
         }
+        run([&](long long count) { for (long long g = 0; g < count; ++g) stepSparseLife(sparse); },
+            [&](const string& path, uint64_t generation) { writeRleSnapshot(path, liveCells(sparse), generation, 0, 0, rule.name); });
+        result.population = sparsePopulation(sparse);
+    } else if (config.engine == "multistate") {
+        ByteLife bytes = makeByteLife(grid.rows, grid.cols, rule);
+        byteLifeFromBitGrid(bytes, grid);
+        run([&](long long count) { for (long long g = 0; g < count; ++g) stepByteLife(bytes); }, [](const string&, uint64_t) {});
+        result.population = byteLifePopulation(bytes);
+    } else if (config.engine == "tiled") {
+        TiledLife tiled = makeTiledLife(grid);
+        run([&](long long count) { for (long long g = 0; g < count; ++g) stepTiledLife(tiled, kernel); }, gridSnapshot(tiled.grid));
+        result.population = popcount(tiled.grid.cur);
+    } else if (config.engine == "parallel") {
+        run([&](long long count) {
+            for (; count > 0; count -= numeric_limits<int>::max())
+                stepBitGridParallel(grid, (int)min<long long>(count, numeric_limits<int>::max()), config.threads, kernel);
+        }, gridSnapshot(grid));
+        result.population = popcount(grid.cur);
+    } else if (config.engine == "torus") {
+        run([&](long long count) { for (long long g = 0; g < count; ++g) stepBitGridTorus(grid, kernel); }, gridSnapshot(grid));
+        result.population = popcount(grid.cur);
+    } else {
+        run([&](long long count) { for (long long g = 0; g < count; ++g) stepBitGrid(grid, kernel); }, gridSnapshot(grid));
+        result.population = popcount(grid.cur);
     }
+    return result;
 }
 
-// Установка Switch Engine
-void setupSwitchEngine(vector<vector<char>>& grid, int startRow, int startColumn, int rows, int cols) {
-    for(int i=0; i<rows; ++i) fill(grid[i].begin(), grid[i].end(), ' '); // Очищаем сетку
+// Значение ключа вида --name value
+string nextArgument(int& i, int argc, char* argv[]) {
+    if (i + 1 >= argc) throw invalid_argument(string("Не указано значение для ") + argv[i]);
+    return argv[++i];
+}
 
-    vector<pair<int, int>> pattern = {
-        {0, 3},
-        {1, 0}, {1, 3}, {1, 5},
-        {2, 0}, {2, 1}, {2, 5},
-        {3, 5},
-        {4, 4}
+// Разбор общих аргументов пакетного режима; неизвестные ключи - ошибка
+LifeBatchConfig parseLifeBatchArguments(int first, int argc, char* argv[], vector<pair<string, string>>* extra = nullptr) {
+    LifeBatchConfig config;
+    for (int i = first; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--rows") config.rows = stoi(nextArgument(i, argc, argv));
+        else if (arg == "--cols") config.cols = stoi(nextArgument(i, argc, argv));
+        else if (arg == "--generations") config.generations = stoll(nextArgument(i, argc, argv));
+        else if (arg == "--seed") config.seed = stoull(nextArgument(i, argc, argv));
+        else if (arg == "--pattern") config.pattern = nextArgument(i, argc, argv);
+        else if (arg == "--engine") config.engine = nextArgument(i, argc, argv);
+        else if (arg == "--rule") config.rule = nextArgument(i, argc, argv);
+        else if (arg == "--threads") config.threads = stoi(nextArgument(i, argc, argv));
+        else if (arg == "--snapshot-every") config.snapshotEvery = stoll(nextArgument(i, argc, argv));
+        else if (arg == "--snapshot-prefix") config.snapshotPrefix = nextArgument(i, argc, argv);
+        else if (extra && arg.rfind("--", 0) == 0) extra->push_back({arg, nextArgument(i, argc, argv)});
+        else throw invalid_argument("Неизвестный аргумент: " + arg);
+    }
+    if (config.rows <= 0 || config.cols <= 0) throw invalid_argument("Размер поля должен быть больше нуля");
+    if (config.threads < 0) throw invalid_argument("Количество потоков не может быть отрицательным.");
+    return config;
+}
+
+// Продолжение со снимка у движков плоскости: Switch Engine у края маленького
+// поля уходит в отрицательные координаты, и снимок поколения 200, снятый
+// после продолжения с поколения 100, должен совпасть со снимком сквозного счета
+bool checkLifeResume() {
+    int failures = 0;
+    auto readFile = [](const string& path) {
+        ifstream in(path, ios::binary);
+        return string(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
     };
+    for (const string engine : {"hashlife", "sparse"}) {
+        LifeBatchConfig config;
+        config.rows = config.cols = 12;
+        config.pattern = "switch";
+        config.engine = engine;
+        config.generations = 200;
+        config.snapshotEvery = 100;
+        config.snapshotPrefix = "life_check_full";
+        runLifeBatch(config);
+        config.pattern = "life_check_full_100.rle";
+        config.generations = 100;
+        config.snapshotPrefix = "life_check_resumed";
+        runLifeBatch(config);
+        const string full = readFile("life_check_full_200.rle"), resumed = readFile("life_check_resumed_200.rle");
+        if (full.empty() || full != resumed || PatternReader("life_check_full_100.rle").offsetCol >= 0) {
+            cout << "Продолжение со снимка (" << engine << "): снимок расходится со сквозным счетом" << endl;
+            ++failures;
+        }
+        for (const char* path : {"life_check_full_100.rle", "life_check_full_200.rle", "life_check_resumed_200.rle"}) remove(path);
+    }
+    cout << "Продолжение со снимка плоскости (hashlife, sparse): " << (failures == 0 ? "OK" : "ОШИБКА") << endl;
+    return failures == 0;
+}
 
-    // Проверяем, помещается ли паттерн
-    int maxRow = 0, maxColumn = 0;
-    for(const auto& p : pattern) {
-        maxRow = max(maxRow, p.first);
-        maxColumn = max(maxColumn, p.second);
+int runLifeBatchMode(int argc, char* argv[]) {
+    const LifeBatchConfig config = parseLifeBatchArguments(2, argc, argv);
+    const LifeBatchResult result = runLifeBatch(config);
+    cout << "Движок: " << config.engine << ", поле " << result.rows << "x" << result.cols
+         << ", поколений: " << config.generations << ", паттерн: " << config.pattern << ", правило: " << result.rule
+         << ", зерно: " << config.seed << endl;
+    if (result.startGeneration != 0)
+        cout << "Продолжение со снимка поколения " << result.startGeneration
+             << ", последнее поколение: " << result.startGeneration + config.generations << endl;
+    cout << "Время: " << result.seconds << " с" << endl;
+    cout << "Поколений в секунду: " << result.generationsPerSecond() << endl;
+    cout << "Обновлений клеток в секунду: " << result.cellUpdatesPerSecond() << endl;
+    cout << "Живых клеток в конце: " << result.population << endl;
+    return 0;
+}
+
+// Воспроизводимый прогон: фиксированное зерно, размеры поля от 512 до 8192
+// и число потоков от 1 до числа ядер. Поколений столько, чтобы каждый прогон
+// обновлял около 2^31 клеток. Результаты пишутся в CSV.
+int runLifeBenchmark(int argc, char* argv[]) {
+    vector<pair<string, string>> extra;
+    LifeBatchConfig base = parseLifeBatchArguments(2, argc, argv, &extra);
+    string outPath = "life_bench.csv";
+    vector<string> engines = {"bit", "simd", "tiled", "parallel"};
+    for (const auto& option : extra) {
+        if (option.first == "--out") {
+            outPath = option.second;
+        } else if (option.first == "--engines") {
+            engines.clear();
+            size_t from = 0;
+            while (from <= option.second.size()) {
+                const size_t comma = option.second.find(',', from);
+                engines.push_back(option.second.substr(from, comma == string::npos ? string::npos : comma - from));
+                if (comma == string::npos) break;
+                from = comma + 1;
+            }
+        } else {
+            throw invalid_argument("Неизвестный аргумент: " + option.first);
+        }
     }
 
-    if (startRow + maxRow < rows && startColumn + maxColumn < cols) {
-        for (const auto& p : pattern) {
-            grid[startRow + p.first][startColumn + p.second] = '0';
+    vector<int> threadCounts;
+    for (int t = 1; t < defaultThreadCount(); t *= 2) threadCounts.push_back(t);
+    threadCounts.push_back(defaultThreadCount());
+
+    ofstream out(outPath);
+    if (!out) throw runtime_error("Не удалось открыть файл " + outPath);
+    out << "engine,kernel,rows,cols,threads,generations,seed,seconds,generations_per_sec,cell_updates_per_sec,population\n";
+    for (const int size : {512, 2048, 8192}) {
+        for (const string& engine : engines) {
+            const vector<int> sweep = engine == "parallel" ? threadCounts : vector<int>{1};
+            for (const int threads : sweep) {
+                LifeBatchConfig config = base;
+                config.rows = config.cols = size;
+                config.engine = engine;
+                config.threads = threads;
+                config.generations = max(8LL, (1LL << 31) / ((long long)size * size));
+                const LifeBatchResult result = runLifeBatch(config);
+                out << engine << "," << activeLifeKernel().name << "," << size << "," << size << "," << threads << ","
+                    << config.generations << "," << config.seed << "," << result.seconds << ","
+                    << result.generationsPerSecond() << "," << result.cellUpdatesPerSecond() << "," << result.population << "\n";
+                cout << engine << " " << size << "x" << size << ", потоков " << threads << ": "
+                     << result.cellUpdatesPerSecond() << " обновлений клеток/с" << endl;
+            }
         }
-    } else {
-        cout << "Предупреждение: Switch Engine не помещается в указанные координаты." << endl
-            << "Попробуйте увеличить размер сетки (рекомендуется хотя бы 10x15 для наблюдения)." << endl;
     }
+    cout << "Результаты записаны в " << outPath << endl;
+    return 0;
+}
+
+// Матрица из файла больше памяти: ./task1 --matrix-file m.bin [--k 2].
+// С --generate файл сначала создается потоково (--rows, --cols, --type, --seed).
+int runMatrixFileMode(int argc, char* argv[]) {
+    int i = 1;
+    const string path = nextArgument(i, argc, argv);
+    bool generate = false;
+    uint64_t rows = 1000, cols = 1000, seed = 42;
+    MatrixElementType type = MatrixElementType::Int32;
+    int k = 2;
+    for (++i; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--generate") generate = true;
+        else if (arg == "--rows") rows = stoull(nextArgument(i, argc, argv));
+        else if (arg == "--cols") cols = stoull(nextArgument(i, argc, argv));
+        else if (arg == "--type") type = parseMatrixElementType(nextArgument(i, argc, argv));
+        else if (arg == "--seed") seed = stoull(nextArgument(i, argc, argv));
+        else if (arg == "--k") k = stoi(nextArgument(i, argc, argv));
+        else throw invalid_argument("Неизвестный аргумент: " + arg);
+    }
+    if (generate) writeMatrixFile(path, rows, cols, type, seed, -50, 50);
+
+    const MappedFile file(path);
+    const MatrixFileHeader header = readMatrixFileHeader(file);
+    const auto start = chrono::steady_clock::now();
+    auto report = [&](const auto& summary) {
+        const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        const size_t dataBytes = header.rows * header.cols * matrixElementSize(header.type);
+        cout << "Матрица " << summary.rows << "x" << summary.cols << " из " << path << endl;
+        cout << "Сумма неотрицательных элементов на пересечении нечетных строк и четных столбцов: " << summary.filteredSum
+             << " (элементов: " << summary.filteredCount << ")" << endl;
+        const int row = kthLargestDistinctRow(summary.rowSums, k);
+        if (row >= 0)
+            cout << "Строка с " << k << "-й по величине суммой: " << row << ", сумма " << summary.rowSums[row] << endl;
+        else
+            cout << "Различных сумм строк меньше " << k << endl;
+        cout << "Время: " << seconds << " с, " << dataBytes / seconds / 1e9 << " ГБ/с" << endl;
+    };
+    switch (header.type) {
+    case MatrixElementType::Int32: report(analyzeMatrixFile<int32_t>(file, header)); break;
+    case MatrixElementType::Int64: report(analyzeMatrixFile<int64_t>(file, header)); break;
+    case MatrixElementType::Float64: report(analyzeMatrixFile<double>(file, header)); break;
+    }
+    return 0;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--check") return (checkLifeKernels() & checkLifeResume() & checkMatrixKernels()) ? 0 : 1;
+    if (argc > 1 && (string(argv[1]) == "--batch" || string(argv[1]) == "--bench" || string(argv[1]) == "--matrix-file")) {
+        try {
+            if (string(argv[1]) == "--matrix-file") return runMatrixFileMode(argc, argv);
+            return string(argv[1]) == "--batch" ? runLifeBatchMode(argc, argv) : runLifeBenchmark(argc, argv);
+        } catch (const exception& e) {
+            cerr << "Ошибка: " << e.what() << endl;
+            return 1;
+        }
+    }
+
     try {
         {
             cout << "Введите количество строк и столбцов матрицы: ";
@@ -129,23 +3348,11 @@ int main() {
             cin >> rows >> cols;
             if (rows <= 0 || cols <= 0) throw invalid_argument("Количество строк и столбцов должно быть больше нуля");
         
-            vector<vector<int>> matrix(rows, vector<int>(cols));
-            for (int i = 0; i < rows; ++i) {
-                for (int j = 0; j < cols; ++j) {
-                    matrix[i][j] = randomNumGen(-50, 50);
-                }
-            }
-            
-            long long sum = 0;
+            Matrix<int> matrix(rows, cols);
+            fillUniformParallel(matrix, -50, 50, nextSessionSeed());
+
             vector<int> newArray;
-            for (int i = 1; i < rows; i += 2) { // Нечетные строки
-                for (int j = 0; j < cols; j += 2) { // Четные столбцы
-                    if (matrix[i][j] >= 0) {
-                        sum += matrix[i][j]; 
-                        newArray.push_back(matrix[i][j]);
-                    }
-                }
-            }
+            const long long sum = sumOddRowsEvenColsParallel(matrix, newArray);
 
             cout << "Сумма неотрицательных элементов на пересечении нечетных строк и четных столбцов: " << sum << endl;
             cout << "Массив из этих элементов: ";
@@ -162,48 +3369,21 @@ int main() {
                 throw invalid_argument("Порядок матрицы должен быть положительным целым числом.");
             }
     
-            vector<vector<int>> matrix(n, vector<int>(n));
-            cout << "Сгенерированная квадратная матрица (" << n << "x" << n << "):" << endl;
-            for (int i = 0; i < n; ++i) {
-                for (int j = 0; j < n; ++j) {
-                    matrix[i][j] = randomNumGen(100, 200);
-                }
-            }
-    
-            vector<pair<long long, int>> indexedSums(n); 
-            cout << "\nСуммы элементов по строкам:" << endl;
-            for (int i = 0; i < n; ++i) {
-                long long currentSum = 0; 
-                currentSum = accumulate(matrix[i].begin(), matrix[i].end(), 0LL); 
-                indexedSums[i] = {currentSum, i};
-            }
-    
+            Matrix<int> matrix(n, n);
+            fillUniformParallel(matrix, 100, 200, nextSessionSeed());
+
             int secondMaxOriginalIndex = -1;
 
-            if (n >= 2) {
-                // Сортируем пары по убыванию сумм
-                sort(indexedSums.begin(), indexedSums.end(), 
-                     [](const pair<long long, int>& a, const pair<long long, int>& b) {
-                    return a.first > b.first; 
-                });
-
-                long long maxSum = indexedSums[0].first;
-                
-                // Ищем первую сумму, которая меньше максимальной
-                for (size_t k = 1; k < indexedSums.size(); ++k) {
-                    if (indexedSums[k].first < maxSum) {
-                        secondMaxOriginalIndex = indexedSums[k].second; 
-                        break;
-                    }
-                }
-            } else
+            if (n >= 2)
+                secondMaxOriginalIndex = kthLargestDistinctRow(matrixRowSums(matrix), 2);
+            else
                 cout << "\nНедостаточно строк (N < 2) для определения второй максимальной суммы." << endl;
             
             if (secondMaxOriginalIndex != -1) {
                 cout << "\nМассив, инициализированный строкой с второй максимальной суммой (исходный индекс " 
                      << secondMaxOriginalIndex << "):" << endl;
-                vector<int> secMaxRow = matrix[secondMaxOriginalIndex]; 
-                for (size_t i = 0; i < secMaxRow.size(); ++i) {
+                const Matrix<int>::RowView secMaxRow = matrix.rowView(secondMaxOriginalIndex);
+                for (int i = 0; i < secMaxRow.size(); ++i) {
                     cout << secMaxRow[i] << (i == secMaxRow.size() - 1 ? "" : ", ");
                 }
                 cout << endl;
@@ -248,8 +3428,9 @@ int main() {
             cout << "\nВыберите начальную конфигурацию для Игры 'Жизнь':" << endl;
             cout << "1. Случайная конфигурация" << endl;
             cout << "2. Switch Engine" << endl;
+            cout << "3. Загрузить паттерн из файла (RLE или .cells)" << endl;
             cin >> choice;
-            if (cin.fail() || (choice < 1 || choice > 4)) { // Обновлена проверка выбора
+            if (cin.fail() || (choice < 1 || choice > 3)) { // Обновлена проверка выбора
                 cin.clear();
                 cin.ignore(numeric_limits<streamsize>::max(), '\n');
                 throw invalid_argument("Неверный выбор конфигурации.");
@@ -269,19 +3450,151 @@ int main() {
                         cout << "Для Switch Engine нужна сетка побольше" << endl;
                     setupSwitchEngine(grid, 2, 2, rows, cols);
                     break;
+                case 3: {
+                    cout << "Введите путь к файлу паттерна: ";
+                    string path;
+                    getline(cin, path);
+                    PatternReader reader(path);
+                    if (reader.height > rows || reader.width > cols)
+                        cout << "Предупреждение: паттерн " << reader.width << "x" << reader.height
+                             << " не помещается в сетку и будет обрезан." << endl;
+                    BitGrid loaded = makeBitGrid(rows, cols);
+                    const auto origin = patternPlacement(reader, rows, cols);
+                    loadPattern(reader, loaded, origin.first, origin.second);
+                    bitGridToChars(loaded, grid);
+                    break;
+                }
+                }
+
+            cout << "\nВыберите движок симуляции:" << endl;
+            cout << "1. Классический (vector<vector<char>>)" << endl;
+            cout << "2. Битовый (64 клетки в слове)" << endl;
+            cout << "3. Битовый SIMD (" << activeLifeKernel().name << ")" << endl;
+            cout << "4. Многопоточный битовый SIMD" << endl;
+            cout << "5. HashLife (прыжки на 2^k поколений)" << endl;
+            cout << "6. Плиточный (пересчет только изменившихся плиток 64x64)" << endl;
+            cout << "7. Битовый SIMD на торе (края поля склеены)" << endl;
+            cout << "8. Бесконечная плоскость (блоки 64x64 в хеш-таблице)" << endl;
+            cout << "9. Многоцветный (Generations, Larger than Life)" << endl;
+            int engine;
+            cin >> engine;
+            if (cin.fail() || engine < 1 || engine > 9) {
+                cin.clear();
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                throw invalid_argument("Неверный выбор движка.");
+            }
+
+            int threads = 1;
+            if (engine == 4) {
+                cout << "Введите количество потоков (0 - по числу ядер, " << defaultThreadCount() << "): ";
+                cin >> threads;
+                if (cin.fail() || threads < 0) {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    throw invalid_argument("Количество потоков не может быть отрицательным.");
                 }
+            }
+            int jumpLog = 0;
+            if (engine == 5) {
+                cout << "Введите k - прыжок на 2^k поколений за кадр (0..56): ";
+                cin >> jumpLog;
+                if (cin.fail() || jumpLog < 0 || jumpLog > 56) {
+                    cin.clear();
+                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                    throw invalid_argument("Показатель прыжка должен быть от 0 до 56.");
+                }
+            }
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
+            cout << "Введите правило (B3/S23, B36/S23, B2/S/C3, R5,C0,M1,S34..58,B34..45,NM; Enter - B3/S23): ";
+            string ruleText;
+            getline(cin, ruleText);
+            const LifeRule rule = parseLifeRule(ruleText.empty() ? "B3/S23" : ruleText);
+            if (engine == 1 && rule.name != "B3/S23") throw invalid_argument("Классический движок считает только B3/S23.");
+            if (engine != 9 && !rule.isLifeLike()) throw invalid_argument("Правило " + rule.name + " считается только многоцветным движком.");
+            const BitRowKernel kernel = rule.isLifeLike() ? lifeRuleKernel(rule, engine != 2) : stepBitRow;
+
+            BitGrid bitGrid;
+            if (engine >= 2) {
+                bitGrid = makeBitGrid(rows, cols);
+                bitGridFromChars(bitGrid, grid);
+            }
+            unique_ptr<HashLife> hashLife;
+            if (engine == 5) {
+                hashLife = make_unique<HashLife>(1 << 22, rule);
+                hashLife->loadFromBitGrid(bitGrid);
+            }
+            TiledLife tiled;
+            if (engine == 6) tiled = makeTiledLife(bitGrid);
+            SparseLife sparse;
+            if (engine == 8) {
+                setSparseRule(sparse, rule);
+                sparseFromBitGrid(sparse, bitGrid);
+            }
+            ByteLife bytes;
+            if (engine == 9) {
+                bytes = makeByteLife(rows, cols, rule);
+                byteLifeFromBitGrid(bytes, bitGrid);
+            }
+
+            // Кадр - одно поколение поля размером с экран: запуск потоков и
+            // копирование полос каждый кадр дороже самого шага, поэтому потоков
+            // не больше, чем окупает работа (threadsForWork), а при одном поток
+            // не запускается вовсе
+            if (engine == 4)
+                threads = min(threads == 0 ? defaultThreadCount() : threads, threadsForWork((size_t)rows * cols));
+
+            TerminalRenderer renderer(rows, cols);
+            FrameLimiter limiter(delay);
             for (int gen = 0; gen < generations; ++gen) {
-                clearScreen();
-                cout << "Игра 'Жизнь' - Поколение: " << gen + 1 << "/" << generations << endl;
-                displayGrid(grid, rows, cols);
-                calculateNextGeneration(grid, rows, cols);
-                sleepMilliseconds(delay);
+                string header;
+                if (engine == 5)
+                    header = "Игра 'Жизнь' - Поколение: " + to_string(hashLife->generation()) + " (кадр " + to_string(gen + 1) + "/" + to_string(generations)
+                           + "), живых клеток: " + to_string(hashLife->population()) + ", узлов: " + to_string(hashLife->nodeCount());
+                else if (engine == 6)
+                    header = "Игра 'Жизнь' - Поколение: " + to_string(gen + 1) + "/" + to_string(generations) + ", активных плиток: "
+                           + to_string(tiled.activeTiles) + "/" + to_string(tiled.changed.size());
+                else if (engine == 8)
+                    header = "Игра 'Жизнь' - Поколение: " + to_string(gen + 1) + "/" + to_string(generations) + ", живых клеток: "
+                           + to_string(sparsePopulation(sparse)) + ", блоков: " + to_string(sparse.chunks.size());
+                else
+                    header = "Игра 'Жизнь' - Поколение: " + to_string(gen + 1) + "/" + to_string(generations);
+                renderer.draw(header, grid);
+                if (engine == 9) {
+                    stepByteLife(bytes);
+                    byteLifeToChars(bytes, grid);
+                } else if (engine == 8) {
+                    // Плоскость бесконечна, на экран выводится окно исходного поля
+                    stepSparseLife(sparse);
+                    sparseToBitGrid(sparse, bitGrid);
+                    bitGridToChars(bitGrid, grid);
+                } else if (engine == 7) {
+                    stepBitGridTorus(bitGrid, kernel);
+                    bitGridToChars(bitGrid, grid);
+                } else if (engine == 6) {
+                    stepTiledLife(tiled, kernel);
+                    bitGridToChars(tiled.grid, grid);
+                } else if (engine == 5) {
+                    // Плоскость бесконечна, на экран выводится окно исходного поля
+                    hashLife->advancePow2(jumpLog);
+                    hashLife->copyToBitGrid(bitGrid);
+                    bitGridToChars(bitGrid, grid);
+                } else if (engine == 4) {
+                    if (threads > 1)
+                        stepBitGridParallel(bitGrid, 1, threads, kernel);
+                    else
+                        stepBitGrid(bitGrid, kernel);
+                    bitGridToChars(bitGrid, grid);
+                } else if (engine == 2 || engine == 3) {
+                    stepBitGrid(bitGrid, kernel);
+                    bitGridToChars(bitGrid, grid);
+                } else
+                    calculateNextGeneration(grid, rows, cols);
+                limiter.wait();
             }
 
-            clearScreen();
-            cout << "Симуляция Игры 'Жизнь' завершена. Финальное состояние:" << endl;
-            displayGrid(grid, rows, cols);
+            renderer.draw("Симуляция Игры 'Жизнь' завершена. Финальное состояние:", grid);
+            renderer.finish();
         }
     }
     catch (const exception& e) {
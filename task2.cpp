@@ -9,19 +9,38 @@
 #include <fstream>
 #include <string>
 #include <limits>
+#include <cstring>
+#include <cctype>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <atomic>
+#include <sstream>
+#include <memory>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
 // типы и константы AES
 using AESBlock = array<uint8_t, 16>;
-using AESKey = AESBlock;
+using AESKey = vector<uint8_t>; // 16, 24 или 32 байта: AES-128, AES-192, AES-256
 using AES_IV = AESBlock;
 using AESState = array<array<uint8_t, 4>, 4>;
-using ExpandedAESKey = array<uint8_t, 176>;
-
 const int Nb = 4;
-const int Nk = 4;
-const int Nr = 10;
+const int MaxNr = 14; // Раундов у AES-256; у AES-128 и AES-192 их 10 и 12
+
+using ExpandedAESKey = array<uint8_t, 16 * (MaxNr + 1)>;
 
 // S-box и Rcon
 const array<uint8_t, 256> S_BOX = {
@@ -44,11 +63,253 @@ const array<uint8_t, 256> S_BOX = {
 };
 const array<uint8_t, 11> R_CON = {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
 
+// Раундовые ключи для быстрого ядра: столбцы как 32-битные слова big-endian
+// (байт 0 столбца - старший), те же байты, что в ExpandedAESKey. Заняты
+// первые rounds + 1 раундовых ключей, остальное - нули.
+struct AESKeySchedule {
+    int rounds = 10;
+    array<uint32_t, Nb * (MaxNr + 1)> words{};
+    alignas(16) array<uint8_t, 16 * (MaxNr + 1)> bytes{}; // То же побайтно - для AES-NI
+};
+
+// T-таблицы: te0[x] - столбец MixColumns от S_BOX[x] в строке 0, остальные -
+// его повороты на 8, 16 и 24 бита для строк 1-3
+struct AESTables {
+    array<uint32_t, 256> te0, te1, te2, te3;
+};
+
+// Реализация AES: программная на T-таблицах или на инструкциях AES-NI.
+// encryptBlocks шифрует независимые блоки (их можно считать вперемешку),
+// cfbEncrypt - последовательная цепочка CFB с регистром обратной связи
+// feedback. Дешифрованию CFB цепочка не нужна, оно строится на encryptBlocks.
+struct AESBackend {
+    const char* name;
+    void (*expandKey)(AESKeySchedule& schedule, const AESKey& key);
+    void (*encryptBlocks)(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t blocks);
+    void (*cfbEncrypt)(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback);
+};
+
+// Ключ GHASH для GCM: H = E(0^128), его степени H^1..H^4 для обработки
+// четырех блоков за шаг и 4-битные таблицы Шоупа для программного умножения
+struct GHashKey {
+    array<AESBlock, 4> powers;
+    array<uint64_t, 16> hl, hh;
+};
+
+// Реализация GHASH: x = (x ^ B) * H для каждого 16-байтного блока B данных,
+// неполный последний блок дополняется нулями
+struct GHashBackend {
+    const char* name;
+    void (*update)(const GHashKey& key, AESBlock& x, const uint8_t* data, size_t size);
+};
+
+// Кеш расширенных ключей, общий для потоков. Ключ ищется по отпечатку -
+// 64-битной свертке байтов ключа с солью процесса, а при совпадении
+// отпечатка ключ еще сравнивается целиком. Расписание отдается как
+// shared_ptr: вытеснение из кеша не мешает тем, кто им еще пользуется, а
+// память расписания затирается, когда его отпускает последний владелец.
+class KeyScheduleCache {
+public:
+    explicit KeyScheduleCache(size_t capacity);
+    ~KeyScheduleCache();
+    KeyScheduleCache(const KeyScheduleCache&) = delete;
+    KeyScheduleCache& operator=(const KeyScheduleCache&) = delete;
+
+    shared_ptr<const AESKeySchedule> get(const AESKey& key);
+    size_t hits() const { return hitCount; }
+    size_t misses() const { return missCount; }
+
+private:
+    struct Entry {
+        uint64_t fingerprint;
+        AESKey key;
+        shared_ptr<const AESKeySchedule> schedule;
+    };
+    uint64_t fingerprint(const AESKey& key) const;
+    void evict(list<Entry>::iterator entry);
+
+    const size_t capacity;
+    const uint64_t salt;
+    mutex lock;
+    list<Entry> entries; // В начале - самые недавние
+    unordered_map<uint64_t, list<Entry>::iterator> index;
+    atomic<size_t> hitCount{0}, missCount{0};
+};
+
+// Контекст шифра: реализация AES и расписание ключа из общего кеша. Один
+// раз построенный контекст шифрует сколько угодно сообщений без повторного
+// расширения ключа; методы константные, контекст можно делить между потоками.
+class AESContext {
+public:
+    explicit AESContext(const AESKey& key);
+    AESContext(const AESKey& key, const AESBackend& backend);
+
+    const AESBackend& backend() const { return *aesBackend; }
+    const AESKeySchedule& schedule() const { return *keySchedule; }
+    int rounds() const { return keySchedule->rounds; }
+
+    void cfbEncrypt(const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback) const;
+    void cfbDecrypt(const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback, int threads = 0) const;
+    void ctrCrypt(const AESBlock& counter, const uint8_t* in, uint8_t* out, size_t size, int threads = 0) const;
+
+private:
+    const AESBackend* aesBackend;
+    shared_ptr<const AESKeySchedule> keySchedule;
+};
+
+// Режимы шифрования в том порядке, в каком они предлагаются в меню
+enum class AESMode { CFB = 1, CTR = 2, GCM = 3 };
+
+// Файл, отображенный в память: только для чтения, для записи на месте или
+// новый файл заданного размера. Отображение выравнивается на 2 МБ, чтобы ядро
+// могло подложить огромные страницы, если файловая система это умеет.
+class MappedFile {
+public:
+    enum class Access { Read, ReadWrite, Create };
+
+    MappedFile(const string& path, Access access, size_t createSize = 0) {
+        const int flags = access == Access::Read ? O_RDONLY : access == Access::ReadWrite ? O_RDWR : O_RDWR | O_CREAT | O_TRUNC;
+        const int fd = open(path.c_str(), flags, 0644);
+        if (fd < 0) throw runtime_error("Не удалось открыть файл " + path + ": " + strerror(errno));
+        struct stat st;
+        if (access == Access::Create ? ftruncate(fd, (off_t)createSize) != 0 : fstat(fd, &st) != 0) {
+            close(fd);
+            throw runtime_error("Не удалось задать или узнать размер файла " + path + ": " + strerror(errno));
+        }
+        length = access == Access::Create ? createSize : (size_t)st.st_size;
+        if (length == 0) {
+            close(fd);
+            return;
+        }
+        // Резервируем на 2 МБ больше, ставим файл по выровненному адресу и
+        // возвращаем лишнее с обоих концов
+        constexpr size_t hugePage = 2 << 20;
+        void* reserved = mmap(nullptr, length + hugePage, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        const int prot = access == Access::Read ? PROT_READ : PROT_READ | PROT_WRITE;
+        void* p = MAP_FAILED;
+        if (reserved != MAP_FAILED) {
+            uint8_t* aligned = (uint8_t*)(((uintptr_t)reserved + hugePage - 1) & ~(uintptr_t)(hugePage - 1));
+            p = mmap(aligned, length, prot, MAP_SHARED | MAP_FIXED, fd, 0);
+            if (p == MAP_FAILED) {
+                munmap(reserved, length + hugePage);
+            } else {
+                const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+                uint8_t* tail = aligned + (length + page - 1) / page * page;
+                if (aligned > (uint8_t*)reserved) munmap(reserved, aligned - (uint8_t*)reserved);
+                if ((uint8_t*)reserved + length + hugePage > tail) munmap(tail, (uint8_t*)reserved + length + hugePage - tail);
+            }
+        }
+        if (p == MAP_FAILED) p = mmap(nullptr, length, prot, MAP_SHARED, fd, 0);
+        close(fd); // Отображение держит файл само
+        if (p == MAP_FAILED) throw runtime_error("Не удалось отобразить файл " + path + ": " + strerror(errno));
+        base = static_cast<uint8_t*>(p);
+        madvise(base, length, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+        madvise(base, length, MADV_HUGEPAGE); // Подсказка: без поддержки ядро ее просто отклонит
+#endif
+    }
+    ~MappedFile() {
+        if (base) munmap(base, length);
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    uint8_t* data() const { return base; }
+    size_t size() const { return length; }
+
+    // Обработанные страницы больше не нужны процессу: измененные остаются в
+    // кеше файла и запишутся ядром, а резидентная память не растет с файлом
+    void release(size_t from, size_t to) const {
+        const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        from = from / page * page;
+        to = to / page * page;
+        if (base && to > from) madvise(base + from, to - from, MADV_DONTNEED);
+    }
+
+private:
+    uint8_t* base = nullptr;
+    size_t length = 0;
+};
+
+// События трассировки справочного AES: состояние после шага раунда,
+// раундовый ключ и блоки цепочки CFB
+enum class TraceEvent : uint8_t {
+    RoundKey, IV, Feedback, Initial, AddRoundKey, SubBytes, ShiftRows, MixColumns, Keystream, Input, Output
+};
+
+// Запись трассировки. Состояние хранится как блок (по столбцам), у
+// неполного последнего блока CFB значащих байт меньше 16
+struct TraceRecord {
+    TraceEvent event;
+    uint8_t round;
+    uint8_t length;
+    uint32_t block;
+    AESBlock data;
+};
+
+// Политика без трассировки: пустые методы исчезают при встраивании, и
+// рабочая конкретизация encryptBlock не содержит ни проверок, ни вывода
+struct NoTrace {
+    void beginBlock(size_t) {}
+    void state(TraceEvent, int, const AESState&) {}
+    void bytes(TraceEvent, int, const uint8_t*, size_t) {}
+};
+
+// Трассировка в заранее выделенный буфер: на каждом шаге раунда копируются
+// 16 байт, текст строится один раз в dump, когда шифрование закончено
+class AESTrace {
+public:
+    AESTrace(size_t blocks, int rounds);
+    void beginBlock(size_t index) { currentBlock = (uint32_t)index; }
+    void state(TraceEvent event, int round, const AESState& s);
+    void bytes(TraceEvent event, int round, const uint8_t* data, size_t size);
+    void dump(ostream& out, bool decrypt) const;
+    size_t size() const { return used; }
+    const TraceRecord& operator[](size_t i) const { return records[i]; }
+
+    // Записей на блок CFB: вход, 4 * rounds + 1 состояний, поток ключей, вход и выход XOR
+    static size_t recordsPerBlock(int rounds) { return 4 * (size_t)rounds + 5; }
+
+private:
+    TraceRecord& next();
+    vector<TraceRecord> records;
+    size_t used = 0;
+    uint32_t currentBlock = 0;
+    int rounds;
+};
+
+// Задание пакетного режима: строка манифеста "вход выход ключ IV [cfb|ctr]",
+// ключ - 32, 48 или 64 шестнадцатеричные цифры
+struct BatchJob {
+    string input, output;
+    AESKey key;
+    AES_IV iv;
+    AESMode mode = AESMode::CFB;
+};
+
+// Итог задания: байты, время от начала до конца задания и ошибка, если была
+struct BatchResult {
+    uint64_t bytes = 0;
+    double seconds = 0;
+    string error;
+};
+
+// Распределение задержек одной операции в замерах --bench-suite: время в
+// наносекундах и такты счетчика на выборку, без накладных расходов таймера
+struct BenchStats {
+    size_t samples = 0;
+    double p50 = 0, p90 = 0, p99 = 0, max = 0;
+    double cycles = 0; // Медиана тактов, 0 - счетчика тактов нет
+};
+
 // Прототипы функций
 void printBlockHex(const AESBlock& block);
 vector<uint8_t> readFromFile(const string& filename);
 void writeToFile(const string& filename, const vector<uint8_t>& data);
 AESBlock loadBlockFromFile(const string& filename);
+AESKey loadKeyFromFile(const string& filename);
+void saveKeyToFile(const AESKey& key, const string& filename);
+void printKeyHex(const AESKey& key);
 void saveBlockToFile(const AESBlock& block, const string& filename);
 AESState blockToState(const AESBlock& block);
 AESBlock stateToBlock(const AESState& state);
@@ -57,19 +318,128 @@ void shiftRows(AESState& state);
 uint8_t gfMulX(uint8_t val);
 void mixColumns(AESState& state);
 void addRoundKey(AESState& state, const ExpandedAESKey& expandedKey, int round);
-void encryptBlock(AESState& state, const ExpandedAESKey& expandedKey, bool verbose);
-void keyExpansion(ExpandedAESKey& expandedKey, const AESKey& key, bool verbose);
+int roundsForKeySize(size_t keySize);
+template <class Trace>
+void encryptBlock(AESState& state, const ExpandedAESKey& expandedKey, int rounds, Trace& trace);
+void encryptBlock(AESState& state, const ExpandedAESKey& expandedKey, int rounds);
+void keyExpansion(ExpandedAESKey& expandedKey, const AESKey& key);
+template <class Trace>
+vector<uint8_t> cfbReference(const vector<uint8_t>& input, const AESKey& key, const AES_IV& iv, bool decrypt, Trace& trace);
+void secureWipe(void* data, size_t size);
+KeyScheduleCache& keyScheduleCache();
 vector<uint8_t> encryptCFB(const vector<uint8_t>& plaintext, const AESKey& key, const AES_IV& iv, bool verbose);
 vector<uint8_t> decryptCFB(const vector<uint8_t>& ciphertext, const AESKey& key, const AES_IV& iv, bool verbose);
+AESTables buildAESTables();
+void expandKeySchedule(AESKeySchedule& schedule, const AESKey& key);
+void encryptBlockFast(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out);
+void cfbEncryptFast(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback);
+void encryptBlocksFast(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t blocks);
+#if defined(__x86_64__) || defined(__i386__)
+bool cpuHasAESNI();
+void expandKeyScheduleAESNI(AESKeySchedule& schedule, const AESKey& key);
+void encryptBlocksAESNI(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t blocks);
+void cfbEncryptAESNI(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback);
+#endif
+vector<AESBackend> availableAESBackends();
+void cfbDecryptBlocks(const AESBackend& backend, const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out,
+                      size_t size, AESBlock& feedback);
+void cfbDecryptParallel(const AESBackend& backend, const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out,
+                        size_t size, AESBlock& feedback, int threads = 0);
+const AESBackend& activeAESBackend();
+int aesThreadCount(size_t size, int threads);
+AESBlock gf128Mul(const AESBlock& x, const AESBlock& y);
+AESBlock gf128Pow(const AESBlock& h, uint64_t k);
+void makeGHashKey(GHashKey& key, const AESBackend& backend, const AESKeySchedule& schedule);
+void ghashUpdateTable(const GHashKey& key, AESBlock& x, const uint8_t* data, size_t size);
+#if defined(__x86_64__) || defined(__i386__)
+bool cpuHasPCLMUL();
+void ghashUpdatePCLMUL(const GHashKey& key, AESBlock& x, const uint8_t* data, size_t size);
+#endif
+vector<GHashBackend> availableGHashBackends();
+const GHashBackend& activeGHashBackend();
+AESBlock addToCounter(const AESBlock& counter, uint64_t n, bool low32);
+void ctrCryptBlocks(const AESBackend& backend, const AESKeySchedule& schedule, const AESBlock& counter,
+                    const uint8_t* in, uint8_t* out, size_t size, bool low32);
+void ctrCryptParallel(const AESBackend& backend, const AESKeySchedule& schedule, const AESBlock& counter,
+                      const uint8_t* in, uint8_t* out, size_t size, int threads = 0, bool low32 = false);
+AESBlock gcmCrypt(const AESBackend& backend, const GHashBackend& ghash, const AESKeySchedule& schedule,
+                  const uint8_t* iv, size_t ivSize, const uint8_t* aad, size_t aadSize,
+                  const uint8_t* in, uint8_t* out, size_t size, bool encrypt, int threads = 0);
+vector<uint8_t> encryptCTR(const vector<uint8_t>& plaintext, const AESKey& key, const AES_IV& iv);
+vector<uint8_t> decryptCTR(const vector<uint8_t>& ciphertext, const AESKey& key, const AES_IV& iv);
+vector<uint8_t> encryptGCM(const vector<uint8_t>& plaintext, const AESKey& key, const vector<uint8_t>& iv,
+                           const vector<uint8_t>& aad, AESBlock& tag);
+vector<uint8_t> decryptGCM(const vector<uint8_t>& ciphertext, const AESKey& key, const vector<uint8_t>& iv,
+                           const vector<uint8_t>& aad, const AESBlock& tag);
+bool sameFile(const string& first, const string& second);
+uint64_t cryptFileStream(const string& inputName, const string& outputName, const AESKey& key, const AES_IV& iv,
+                         AESMode mode, bool encrypt, size_t chunkSize = 4 << 20);
+uint64_t cryptFileMapped(const string& inputName, const string& outputName, const AESKey& key, const AES_IV& iv,
+                         AESMode mode, bool encrypt);
+vector<uint8_t> parseHexBytes(const string& text);
+AESBlock parseHexBlock(const string& text);
+vector<BatchJob> readBatchManifest(const string& path);
+vector<BatchResult> runBatchJobs(const vector<BatchJob>& jobs, bool encrypt, int threads);
+bool checkAES();
+int runAESBenchmark(int argc, char* argv[]);
+uint64_t readCycleCounter();
+template <class Body>
+BenchStats measureLatency(Body&& body, double overhead, uint64_t cycleOverhead);
+int runAESBenchmarkSuite(int argc, char* argv[]);
+int runAESBatch(int argc, char* argv[]);
 
+const AESTables AES_TABLES = buildAESTables();
 
-int main() {
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--check") return checkAES() ? 0 : 1;
+    if (argc > 1 && (string(argv[1]) == "--bench" || string(argv[1]) == "--bench-suite" || string(argv[1]) == "--batch")) {
+        try {
+            if (string(argv[1]) == "--bench-suite") return runAESBenchmarkSuite(argc, argv);
+            return string(argv[1]) == "--bench" ? runAESBenchmark(argc, argv) : runAESBatch(argc, argv);
+        } catch (const exception& e) {
+            cerr << "Произошла ошибка: " << e.what() << endl;
+            return 1;
+        }
+    }
     try {
         cout << "Выберите режим работы:\n1. Шифрование\n2. Дешифрование\n";
         int mode;
         cin >> mode;
         cin.ignore(numeric_limits<streamsize>::max(), '\n');
 
+        cout << "Режим шифрования:\n1. CFB\n2. CTR\n3. GCM (с проверкой целостности)\n";
+        int cipherMode;
+        cin >> cipherMode;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        if (cipherMode < 1 || cipherMode > 3) {
+            cout << "Неверный выбор режима шифрования." << endl;
+            return 1;
+        }
+
+        // Файл можно обработать потоком кусками, через mmap в новый файл или
+        // через mmap на месте: тогда сам файл становится результатом и
+        // переименовывается в него
+        auto askFileMethod = [] {
+            cout << "Способ обработки файла:\n1. Потоково кусками\n2. mmap в новый файл\n3. mmap на месте (входной файл перезаписывается)\n";
+            int method;
+            cin >> method;
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            if (method < 1 || method > 3) throw invalid_argument("Неверный выбор способа обработки файла");
+            return method;
+        };
+        auto cryptFileByMethod = [&](int method, const string& from, const string& to, const AESKey& key, const AES_IV& iv,
+                                     bool encrypt) {
+            const AESMode aesMode = static_cast<AESMode>(cipherMode);
+            if (method == 1) cryptFileStream(from, to, key, iv, aesMode, encrypt);
+            else if (method == 2) cryptFileMapped(from, to, key, iv, aesMode, encrypt);
+            else {
+                cryptFileMapped(from, "", key, iv, aesMode, encrypt);
+                if (rename(from.c_str(), to.c_str()) != 0)
+                    throw runtime_error("Не удалось переименовать " + from + " в " + to + ": " + strerror(errno));
+            }
+        };
+
         char verboseChoice;
         cout << "Включить подробный вывод промежуточных состояний и расширенного ключа? (y/n): ";
         cin >> verboseChoice;
@@ -78,6 +448,7 @@ int main() {
 
         if (mode == 1) {
             vector<uint8_t> plaintext;
+            string inputFilename;
             cout << "Источник данных:\n1. Ввод с клавиатуры\n2. Чтение из файла\n";
             int sourceChoice;
             cin >> sourceChoice;
@@ -89,45 +460,76 @@ int main() {
                 getline(cin, inputText);
                 plaintext.assign(inputText.begin(), inputText.end());
             } else if (sourceChoice == 2) {
-                string inputFilename;
                 cout << "Введите имя входного файла: ";
                 getline(cin, inputFilename);
-                plaintext = readFromFile(inputFilename);
             } else {
                 cout << "Неверный выбор источника данных." << endl;
                 return 1;
             }
 
+            cout << "Длина ключа:\n1. 128 бит\n2. 192 бита\n3. 256 бит\n";
+            int keyChoice;
+            cin >> keyChoice;
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            if (keyChoice < 1 || keyChoice > 3) {
+                cout << "Неверный выбор длины ключа." << endl;
+                return 1;
+            }
+
             // Генерация случайных ключа и вектора инициализации (IV)
             random_device rd;
             mt19937 gen(rd());
             uniform_int_distribution<uint8_t> dis(0, 255);
-            AESKey key;
+            AESKey key(8 + 8 * keyChoice);
             generate(key.begin(), key.end(), [&]() { return dis(gen); });
             AES_IV iv;
             generate(iv.begin(), iv.end(), [&]() { return dis(gen); });
 
             // Выводим сгенерированные ключ и IV.
             cout << "\nСгенерированный ключ (Hex): ";
-            printBlockHex(key);
+            printKeyHex(key);
             cout << "Сгенерированный IV (Hex):   ";
             printBlockHex(iv);
 
-            vector<uint8_t> ciphertext = encryptCFB(plaintext, key, iv, verbose);
+            // Файл в CFB и CTR без подробного вывода целиком в память не читается
+            const bool streaming = !inputFilename.empty() && cipherMode != 3 && !verbose;
+            if (!inputFilename.empty() && !streaming) plaintext = readFromFile(inputFilename);
+
+            // Подробный вывод есть только у справочного CFB; в GCM nonce - первые 12 байт IV
+            vector<uint8_t> ciphertext;
+            if (streaming) cryptFileByMethod(askFileMethod(), inputFilename, "ciphertext.bin", key, iv, true);
+            else if (cipherMode == 1) ciphertext = encryptCFB(plaintext, key, iv, verbose);
+            else if (cipherMode == 2) ciphertext = encryptCTR(plaintext, key, iv);
+            else {
+                AESBlock tag;
+                ciphertext = encryptGCM(plaintext, key, vector<uint8_t>(iv.begin(), iv.begin() + 12), {}, tag);
+                saveBlockToFile(tag, "tag.bin");
+                cout << "Тег GCM (Hex):              ";
+                printBlockHex(tag);
+            }
 
-            saveBlockToFile(key, "key.bin");
+            saveKeyToFile(key, "key.bin");
             saveBlockToFile(iv, "iv.bin");
-            writeToFile("ciphertext.bin", ciphertext);
-            cout << "Ключ, IV и шифротекст сохранены в файлы key.bin, iv.bin, ciphertext.bin\n";
+            if (!streaming) writeToFile("ciphertext.bin", ciphertext);
+            cout << "Ключ, IV и шифротекст сохранены в файлы key.bin, iv.bin, ciphertext.bin"
+                 << (cipherMode == 3 ? ", тег - в tag.bin" : "") << "\n";
 
         } else if (mode == 2) {
-            AESKey key = loadBlockFromFile("key.bin");
+            AESKey key = loadKeyFromFile("key.bin");
             AES_IV iv = loadBlockFromFile("iv.bin");
-            vector<uint8_t> ciphertext = readFromFile("ciphertext.bin");
+            if (cipherMode != 3 && !verbose) {
+                cryptFileByMethod(askFileMethod(), "ciphertext.bin", "decrypted_output.txt", key, iv, false);
+            } else {
+                vector<uint8_t> ciphertext = readFromFile("ciphertext.bin");
 
-            vector<uint8_t> decryptedtext = decryptCFB(ciphertext, key, iv, verbose);
-            
-            writeToFile("decrypted_output.txt", decryptedtext);
+                vector<uint8_t> decryptedtext;
+                if (cipherMode == 1) decryptedtext = decryptCFB(ciphertext, key, iv, verbose);
+                else if (cipherMode == 2) decryptedtext = decryptCTR(ciphertext, key, iv);
+                else decryptedtext = decryptGCM(ciphertext, key, vector<uint8_t>(iv.begin(), iv.begin() + 12), {},
+                                                loadBlockFromFile("tag.bin"));
+
+                writeToFile("decrypted_output.txt", decryptedtext);
+            }
             cout << "Расшифрованный текст сохранен в файл decrypted_output.txt\n";
             
         } else {
@@ -176,10 +578,11 @@ uint8_t gfMulX(uint8_t val) {
 void mixColumns(AESState& state) {
     for (int c = 0; c < Nb; ++c) {
         uint8_t s0 = state[0][c], s1 = state[1][c], s2 = state[2][c], s3 = state[3][c];
-        state[0][c] = gfMulX(s0) ^ s1 ^ s2 ^ gfMulX(s3) ^ s3;
-        state[1][c] = gfMulX(s1) ^ s2 ^ s3 ^ gfMulX(s0) ^ s0;
-        state[2][c] = gfMulX(s2) ^ s3 ^ s0 ^ gfMulX(s1) ^ s1;
-        state[3][c] = gfMulX(s3) ^ s0 ^ s1 ^ gfMulX(s2) ^ s2;
+        // Столбец умножается на {02 03 01 01} с циклическим сдвигом (FIPS-197, 5.1.3)
+        state[0][c] = gfMulX(s0) ^ gfMulX(s1) ^ s1 ^ s2 ^ s3;
+        state[1][c] = s0 ^ gfMulX(s1) ^ gfMulX(s2) ^ s2 ^ s3;
+        state[2][c] = s0 ^ s1 ^ gfMulX(s2) ^ gfMulX(s3) ^ s3;
+        state[3][c] = gfMulX(s0) ^ s0 ^ s1 ^ s2 ^ gfMulX(s3);
     }
 }
 
@@ -188,68 +591,50 @@ void addRoundKey(AESState& state, const ExpandedAESKey& expandedKey, int round)
     for (int r = 0; r < Nb; ++r) for (int c = 0; c < Nb; ++c) state[r][c] ^= currentRoundKey[c * Nb + r];
 }
 
-void encryptBlock(AESState& state, const ExpandedAESKey& expandedKey, bool verbose) {
-    if (verbose) {
-        cout << "  Начальное состояние блока (до AddRoundKey 0):\n";
-        for (int r = 0; r < Nb; ++r) {
-            cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " ";
-            cout << "\n";
-        }
-    }
+// Nr по длине ключа (FIPS-197, 5): Nk + 6 для Nk = 4, 6, 8 слов
+int roundsForKeySize(size_t keySize) {
+    if (keySize != 16 && keySize != 24 && keySize != 32)
+        throw invalid_argument("Длина ключа AES должна быть 16, 24 или 32 байта, а не " + to_string(keySize));
+    return (int)keySize / 4 + 6;
+}
 
+// Справочное шифрование блока. Trace получает состояние после каждого шага:
+// с NoTrace это обычная функция без накладных расходов, с AESTrace - запись
+// промежуточных состояний для подробного вывода
+template <class Trace>
+void encryptBlock(AESState& state, const ExpandedAESKey& expandedKey, int rounds, Trace& trace) {
+    trace.state(TraceEvent::Initial, 0, state);
     addRoundKey(state, expandedKey, 0);
-    if (verbose) {
-        cout << "  После AddRoundKey (Раунд 0):\n";
-        for (int r = 0; r < Nb; ++r) {
-            cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " ";
-            cout << "\n";
-        }
-    }
-    
-    for (int round = 1; round < Nr; ++round) {
+    trace.state(TraceEvent::AddRoundKey, 0, state);
+
+    for (int round = 1; round < rounds; ++round) {
         subBytes(state);
-        if (verbose) {
-            cout << "  После SubBytes (Раунд " << round << "):\n";
-            for (int r = 0; r < Nb; ++r) { cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " "; cout << "\n"; }
-        }
+        trace.state(TraceEvent::SubBytes, round, state);
         shiftRows(state);
-        if (verbose) {
-            cout << "  После ShiftRows (Раунд " << round << "):\n";
-            for (int r = 0; r < Nb; ++r) { cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " "; cout << "\n"; }
-        }
+        trace.state(TraceEvent::ShiftRows, round, state);
         mixColumns(state);
-        if (verbose) {
-            cout << "  После MixColumns (Раунд " << round << "):\n";
-            for (int r = 0; r < Nb; ++r) { cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " "; cout << "\n"; }
-        }
+        trace.state(TraceEvent::MixColumns, round, state);
         addRoundKey(state, expandedKey, round);
-        if (verbose) {
-            cout << "  После AddRoundKey (Раунд " << round << "):\n";
-            for (int r = 0; r < Nb; ++r) { cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " "; cout << "\n"; }
-        }
+        trace.state(TraceEvent::AddRoundKey, round, state);
     }
-    
-    // Финальный, 10-й раунд (без MixColumns).
+
+    // Финальный раунд (без MixColumns).
     subBytes(state);
-    if (verbose) {
-        cout << "  После финального SubBytes:\n";
-        for (int r = 0; r < Nb; ++r) { cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " "; cout << "\n"; }
-    }
+    trace.state(TraceEvent::SubBytes, rounds, state);
     shiftRows(state);
-    if (verbose) {
-        cout << "  После финального ShiftRows:\n";
-        for (int r = 0; r < Nb; ++r) { cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " "; cout << "\n"; }
-    }
-    addRoundKey(state, expandedKey, Nr);
-    if (verbose) {
-        cout << "  Финальное состояние блока (после всех раундов):\n";
-        for (int r = 0; r < Nb; ++r) { cout << "    "; for (int c = 0; c < Nb; ++c) cout << hex << setw(2) << setfill('0') << static_cast<int>(state[r][c]) << " "; cout << "\n"; }
-        cout << dec;
-    }
+    trace.state(TraceEvent::ShiftRows, rounds, state);
+    addRoundKey(state, expandedKey, rounds);
+    trace.state(TraceEvent::AddRoundKey, rounds, state);
+}
+
+void encryptBlock(AESState& state, const ExpandedAESKey& expandedKey, int rounds) {
+    NoTrace trace;
+    encryptBlock(state, expandedKey, rounds, trace);
 }
 
 // Генерация раундовых ключей из исходного ключа.
-void keyExpansion(ExpandedAESKey& expandedKey, const AESKey& key, bool verbose) {
+void keyExpansion(ExpandedAESKey& expandedKey, const AESKey& key) {
+    const int Nr = roundsForKeySize(key.size()), Nk = (int)key.size() / 4;
     copy(key.begin(), key.end(), expandedKey.begin());
     array<uint8_t, 4> tempWord;
     int bytesGenerated = Nk * Nb;
@@ -262,127 +647,887 @@ void keyExpansion(ExpandedAESKey& expandedKey, const AESKey& key, bool verbose)
             rotate(tempWord.begin(), tempWord.begin() + 1, tempWord.end());
             transform(tempWord.begin(), tempWord.end(), tempWord.begin(), [](uint8_t b) { return S_BOX[b]; });
             tempWord[0] ^= R_CON[rconIter++];
+        } else if (Nk > 6 && bytesGenerated % (Nk * Nb) == 4 * Nb) {
+            // У 256-битного ключа посередине периода еще один SubWord
+            transform(tempWord.begin(), tempWord.end(), tempWord.begin(), [](uint8_t b) { return S_BOX[b]; });
         }
         for (int i = 0; i < 4; ++i) {
             expandedKey[bytesGenerated] = expandedKey[bytesGenerated - (Nk * Nb)] ^ tempWord[i];
             ++bytesGenerated;
         }
     }
+}
 
-    if (verbose) {
-        for (int round = 0; round <= Nr; ++round) {
-            cout << "Раунд " << setw(2) << round << ": ";
-            for (int i = 0; i < Nb * 4; ++i) {
-                cout << hex << setw(2) << setfill('0') << static_cast<int>(expandedKey[round * Nb * 4 + i]) << " ";
-            }
-            cout << "\n";
-        }
-        cout << dec << endl;
+// Быстрое ядро AES. Состояние - четыре столбца по 32 бита; SubBytes,
+// ShiftRows и MixColumns раунда сводятся к четырем поискам в T-таблицах на
+// столбец, без перекладывания в AESState. Поиск по таблице зависит от данных,
+// так что ядро не постоянно по времени - как и справочный encryptBlock.
+AESTables buildAESTables() {
+    AESTables t;
+    for (int x = 0; x < 256; ++x) {
+        const uint8_t s = S_BOX[x], s2 = gfMulX(s), s3 = s2 ^ s;
+        const uint32_t w = (uint32_t)s2 << 24 | (uint32_t)s << 16 | (uint32_t)s << 8 | s3;
+        t.te0[x] = w;
+        t.te1[x] = w >> 8 | w << 24;
+        t.te2[x] = w >> 16 | w << 16;
+        t.te3[x] = w >> 24 | w << 8;
     }
+    return t;
 }
 
-// Функции режима CFB
-vector<uint8_t> encryptCFB(const vector<uint8_t>& plaintext, const AESKey& key, const AES_IV& iv, bool verbose) {
-    if (plaintext.empty()) return {};
-    
+static inline uint32_t loadBigEndian(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void storeBigEndian(uint8_t* p, uint32_t w) {
+    p[0] = (uint8_t)(w >> 24);
+    p[1] = (uint8_t)(w >> 16);
+    p[2] = (uint8_t)(w >> 8);
+    p[3] = (uint8_t)w;
+}
+
+void expandKeySchedule(AESKeySchedule& schedule, const AESKey& key) {
     ExpandedAESKey expandedKey;
-    keyExpansion(expandedKey, key, verbose);
+    keyExpansion(expandedKey, key);
+    schedule.rounds = roundsForKeySize(key.size());
+    for (int i = 0; i < Nb * (schedule.rounds + 1); ++i) schedule.words[i] = loadBigEndian(expandedKey.data() + 4 * i);
+    copy_n(expandedKey.begin(), 16 * (schedule.rounds + 1), schedule.bytes.begin());
+    secureWipe(expandedKey.data(), expandedKey.size());
+}
 
-    vector<uint8_t> ciphertext(plaintext.size());
-    AESBlock currentFeedback = iv;
+void encryptBlockFast(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out) {
+    const uint32_t* rk = schedule.words.data();
+    const AESTables& t = AES_TABLES;
+    uint32_t s0 = loadBigEndian(in) ^ rk[0], s1 = loadBigEndian(in + 4) ^ rk[1];
+    uint32_t s2 = loadBigEndian(in + 8) ^ rk[2], s3 = loadBigEndian(in + 12) ^ rk[3];
+    for (int round = 1; round < schedule.rounds; ++round) {
+        rk += Nb;
+        // Столбец c берет строку r из столбца c + r: это и есть ShiftRows
+        const uint32_t t0 = t.te0[s0 >> 24] ^ t.te1[s1 >> 16 & 0xFF] ^ t.te2[s2 >> 8 & 0xFF] ^ t.te3[s3 & 0xFF] ^ rk[0];
+        const uint32_t t1 = t.te0[s1 >> 24] ^ t.te1[s2 >> 16 & 0xFF] ^ t.te2[s3 >> 8 & 0xFF] ^ t.te3[s0 & 0xFF] ^ rk[1];
+        const uint32_t t2 = t.te0[s2 >> 24] ^ t.te1[s3 >> 16 & 0xFF] ^ t.te2[s0 >> 8 & 0xFF] ^ t.te3[s1 & 0xFF] ^ rk[2];
+        const uint32_t t3 = t.te0[s3 >> 24] ^ t.te1[s0 >> 16 & 0xFF] ^ t.te2[s1 >> 8 & 0xFF] ^ t.te3[s2 & 0xFF] ^ rk[3];
+        s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+    }
+    rk += Nb;
+    // Последний раунд без MixColumns: только S_BOX и сдвиг строк
+    auto last = [&](uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t k) {
+        return ((uint32_t)S_BOX[a >> 24] << 24 | (uint32_t)S_BOX[b >> 16 & 0xFF] << 16
+                | (uint32_t)S_BOX[c >> 8 & 0xFF] << 8 | S_BOX[d & 0xFF]) ^ k;
+    };
+    storeBigEndian(out, last(s0, s1, s2, s3, rk[0]));
+    storeBigEndian(out + 4, last(s1, s2, s3, s0, rk[1]));
+    storeBigEndian(out + 8, last(s2, s3, s0, s1, rk[2]));
+    storeBigEndian(out + 12, last(s3, s0, s1, s2, rk[3]));
+}
+
+// CFB на быстром ядре. feedback - регистр обратной связи: на входе IV или
+// состояние после предыдущего куска, на выходе - последний блок шифротекста,
+// так что длинные данные можно обрабатывать частями. in и out могут совпадать.
+void cfbEncryptFast(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback) {
+    AESBlock keystream;
+    for (size_t i = 0; i < size; i += 16) {
+        encryptBlockFast(schedule, feedback.data(), keystream.data());
+        const size_t n = min<size_t>(16, size - i);
+        for (size_t j = 0; j < n; ++j) feedback[j] = out[i + j] = in[i + j] ^ keystream[j];
+    }
+}
+
+void encryptBlocksFast(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t blocks) {
+    for (size_t b = 0; b < blocks; ++b) encryptBlockFast(schedule, in + 16 * b, out + 16 * b);
+}
 
-    if (verbose) {
-        cout << "Начальный IV (Feedback): "; printBlockHex(iv);
+#if defined(__x86_64__) || defined(__i386__)
+// AES-NI: раунд AES - одна инструкция aesenc над 128-битным регистром
+bool cpuHasAESNI() {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES) && (ecx & bit_SSE2 || edx & bit_SSE2);
+}
+
+// Шаг расписания ключей: aeskeygenassist дает RotWord(SubWord(w3)) ^ Rcon,
+// а сдвиги с XOR превращают (w0, w1, w2, w3) в префиксные XOR-суммы
+__attribute__((target("aes,sse2")))
+static inline __m128i expandKeyStep(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xFF);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+// aeskeygenassist развернут только для 128-битного ключа; расписания AES-192
+// и AES-256 строятся программно - расширение ключа все равно кешируется
+__attribute__((target("aes,sse2")))
+void expandKeyScheduleAESNI(AESKeySchedule& schedule, const AESKey& key) {
+    if (key.size() != 16) {
+        expandKeySchedule(schedule, key);
+        return;
     }
+    schedule.rounds = 10;
+    __m128i* rk = reinterpret_cast<__m128i*>(schedule.bytes.data());
+    rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key.data()));
+    // Rcon у aeskeygenassist - непосредственный операнд, поэтому без цикла
+    rk[1] = expandKeyStep(rk[0], _mm_aeskeygenassist_si128(rk[0], 0x01));
+    rk[2] = expandKeyStep(rk[1], _mm_aeskeygenassist_si128(rk[1], 0x02));
+    rk[3] = expandKeyStep(rk[2], _mm_aeskeygenassist_si128(rk[2], 0x04));
+    rk[4] = expandKeyStep(rk[3], _mm_aeskeygenassist_si128(rk[3], 0x08));
+    rk[5] = expandKeyStep(rk[4], _mm_aeskeygenassist_si128(rk[4], 0x10));
+    rk[6] = expandKeyStep(rk[5], _mm_aeskeygenassist_si128(rk[5], 0x20));
+    rk[7] = expandKeyStep(rk[6], _mm_aeskeygenassist_si128(rk[6], 0x40));
+    rk[8] = expandKeyStep(rk[7], _mm_aeskeygenassist_si128(rk[7], 0x80));
+    rk[9] = expandKeyStep(rk[8], _mm_aeskeygenassist_si128(rk[8], 0x1B));
+    rk[10] = expandKeyStep(rk[9], _mm_aeskeygenassist_si128(rk[9], 0x36));
+    for (int i = 0; i < Nb * 11; ++i) schedule.words[i] = loadBigEndian(schedule.bytes.data() + 4 * i);
+}
 
-    for (size_t i = 0; i < plaintext.size(); i += 16) {
-        if (verbose) {
-            cout << "\nБлок " << (i / 16) + 1 << " (Шифрование CFB):\n";
-            cout << "  Текущий блок обратной связи (вход для AES): "; printBlockHex(currentFeedback);
+__attribute__((target("aes,sse2")))
+static inline __m128i encryptRegisterAESNI(const __m128i* rk, int rounds, __m128i block) {
+    block = _mm_xor_si128(block, rk[0]);
+    for (int round = 1; round < rounds; ++round) block = _mm_aesenc_si128(block, rk[round]);
+    return _mm_aesenclast_si128(block, rk[rounds]);
+}
+
+// По 8 блоков одновременно: у aesenc задержка в несколько тактов, но новая
+// инструкция может начинаться каждый такт, и независимые блоки заполняют конвейер.
+// Число раундов - параметр шаблона, чтобы цикл раундов разворачивался.
+template <int Rounds>
+__attribute__((target("aes,sse2")))
+static void encryptBlocksAESNIRounds(const __m128i* rk, const uint8_t* in, uint8_t* out, size_t blocks) {
+    const __m128i* src = reinterpret_cast<const __m128i*>(in);
+    __m128i* dst = reinterpret_cast<__m128i*>(out);
+    size_t b = 0;
+    for (; b + 8 <= blocks; b += 8) {
+        __m128i x[8];
+#pragma GCC unroll 8
+        for (int k = 0; k < 8; ++k) x[k] = _mm_xor_si128(_mm_loadu_si128(src + b + k), rk[0]);
+        for (int round = 1; round < Rounds; ++round) {
+            const __m128i roundKey = rk[round];
+#pragma GCC unroll 8
+            for (int k = 0; k < 8; ++k) x[k] = _mm_aesenc_si128(x[k], roundKey);
         }
+#pragma GCC unroll 8
+        for (int k = 0; k < 8; ++k) _mm_storeu_si128(dst + b + k, _mm_aesenclast_si128(x[k], rk[Rounds]));
+    }
+    for (; b < blocks; ++b) _mm_storeu_si128(dst + b, encryptRegisterAESNI(rk, Rounds, _mm_loadu_si128(src + b)));
+}
+
+void encryptBlocksAESNI(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t blocks) {
+    const __m128i* rk = reinterpret_cast<const __m128i*>(schedule.bytes.data());
+    if (schedule.rounds == 10) encryptBlocksAESNIRounds<10>(rk, in, out, blocks);
+    else if (schedule.rounds == 12) encryptBlocksAESNIRounds<12>(rk, in, out, blocks);
+    else encryptBlocksAESNIRounds<14>(rk, in, out, blocks);
+}
+
+// Неполный последний блок проходит через временный буфер, чтобы не читать и
+// не писать за концом данных
+__attribute__((target("aes,sse2")))
+void cfbEncryptAESNI(const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback) {
+    const __m128i* rk = reinterpret_cast<const __m128i*>(schedule.bytes.data());
+    __m128i fb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(feedback.data()));
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        fb = _mm_xor_si128(encryptRegisterAESNI(rk, schedule.rounds, fb), _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), fb);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(feedback.data()), fb);
+    if (i < size) {
+        AESBlock keystream;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(keystream.data()), encryptRegisterAESNI(rk, schedule.rounds, fb));
+        for (size_t j = 0; i + j < size; ++j) feedback[j] = out[i + j] = in[i + j] ^ keystream[j];
+    }
+}
+
+#endif
+
+// Все реализации, которые может выполнить этот процессор; первая - лучшая
+vector<AESBackend> availableAESBackends() {
+    vector<AESBackend> backends;
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpuHasAESNI())
+        backends.push_back({"AES-NI", expandKeyScheduleAESNI, encryptBlocksAESNI, cfbEncryptAESNI});
+#endif
+    backends.push_back({"T-таблицы", expandKeySchedule, encryptBlocksFast, cfbEncryptFast});
+    return backends;
+}
 
-        AESState state = blockToState(currentFeedback);
-        encryptBlock(state, expandedKey, verbose);
-        AESBlock keystreamBlock = stateToBlock(state);
+const AESBackend& activeAESBackend() {
+    static const AESBackend backend = availableAESBackends().front();
+    return backend;
+}
+
+// Затирание ключевого материала: запись через volatile компилятор не может
+// выбросить как запись в память, которую больше никто не читает
+void secureWipe(void* data, size_t size) {
+    volatile uint8_t* p = static_cast<volatile uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) p[i] = 0;
+}
+
+KeyScheduleCache::KeyScheduleCache(size_t capacity)
+    : capacity(max<size_t>(1, capacity)), salt((uint64_t)random_device{}() << 32 | random_device{}()) {}
+
+KeyScheduleCache::~KeyScheduleCache() {
+    while (!entries.empty()) evict(prev(entries.end()));
+}
+
+// Свертка SplitMix64 по 8-байтным словам ключа, начиная с соли процесса:
+// отпечаток не сохраняется и от запуска к запуску разный
+uint64_t KeyScheduleCache::fingerprint(const AESKey& key) const {
+    uint64_t h = salt ^ key.size();
+    for (size_t i = 0; i < key.size(); i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, key.data() + i, min<size_t>(8, key.size() - i));
+        h ^= word;
+        h += 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+void KeyScheduleCache::evict(list<Entry>::iterator entry) {
+    index.erase(entry->fingerprint);
+    secureWipe(entry->key.data(), entry->key.size());
+    entries.erase(entry); // Расписание затрет удалитель, когда его отпустят все
+}
 
-        if (verbose) {
-            cout << "  Сгенерированный поток ключей (выход AES): "; printBlockHex(keystreamBlock);
-            cout << "  Исходный блок (XOR с потоком ключей): ";
-            for (size_t j = 0; j < min<size_t>(16, plaintext.size() - i); ++j) {
-                 cout << hex << setw(2) << setfill('0') << static_cast<int>(plaintext[i+j]) << " ";
+shared_ptr<const AESKeySchedule> KeyScheduleCache::get(const AESKey& key) {
+    const uint64_t print = fingerprint(key);
+    {
+        lock_guard<mutex> guard(lock);
+        const auto found = index.find(print);
+        if (found != index.end()) {
+            if (found->second->key == key) {
+                entries.splice(entries.begin(), entries, found->second);
+                ++hitCount;
+                return found->second->schedule;
             }
-            cout << dec << "\n";
+            evict(found->second); // Совпал только отпечаток: старый ключ уступает место
         }
-        
-        const size_t bytesToProcess = min<size_t>(16, plaintext.size() - i);
-        for (size_t j = 0; j < bytesToProcess; ++j) {
-            ciphertext[i + j] = plaintext[i + j] ^ keystreamBlock[j];
-        }
-        
-        copy(ciphertext.begin() + i, ciphertext.begin() + i + bytesToProcess, currentFeedback.begin());
+    }
+    // Расширение - вне блокировки: другие потоки тем временем берут свои ключи.
+    // Если этот же ключ параллельно расширил кто-то еще, в кеше останется одна копия.
+    ++missCount;
+    unique_ptr<AESKeySchedule> expanded(new AESKeySchedule);
+    activeAESBackend().expandKey(*expanded, key);
+    const shared_ptr<const AESKeySchedule> schedule(expanded.release(), [](const AESKeySchedule* p) {
+        secureWipe(const_cast<AESKeySchedule*>(p), sizeof(AESKeySchedule));
+        delete p;
+    });
 
-        if (verbose) {
-            cout << "  Полученный зашифрованный блок: ";
-            for (size_t j = 0; j < bytesToProcess; ++j) {
-                cout << hex << setw(2) << setfill('0') << static_cast<int>(ciphertext[i+j]) << " ";
-            }
-            cout << dec << "\n";
+    lock_guard<mutex> guard(lock);
+    const auto found = index.find(print);
+    if (found != index.end()) {
+        if (found->second->key == key) return found->second->schedule;
+        evict(found->second);
+    }
+    entries.push_front({print, key, schedule});
+    index[print] = entries.begin();
+    if (entries.size() > capacity) evict(prev(entries.end()));
+    return schedule;
+}
+
+// Общий кеш процесса; 64 ключа хватает пакетному режиму с повторами ключей
+KeyScheduleCache& keyScheduleCache() {
+    static KeyScheduleCache cache(64);
+    return cache;
+}
+
+AESContext::AESContext(const AESKey& key) : AESContext(key, activeAESBackend()) {}
+
+// Расписание одинаково у всех реализаций, поэтому кеш общий для них
+AESContext::AESContext(const AESKey& key, const AESBackend& backend)
+    : aesBackend(&backend), keySchedule(keyScheduleCache().get(key)) {}
+
+void AESContext::cfbEncrypt(const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback) const {
+    aesBackend->cfbEncrypt(*keySchedule, in, out, size, feedback);
+}
+
+void AESContext::cfbDecrypt(const uint8_t* in, uint8_t* out, size_t size, AESBlock& feedback, int threads) const {
+    cfbDecryptParallel(*aesBackend, *keySchedule, in, out, size, feedback, threads);
+}
+
+void AESContext::ctrCrypt(const AESBlock& counter, const uint8_t* in, uint8_t* out, size_t size, int threads) const {
+    ctrCryptParallel(*aesBackend, *keySchedule, counter, in, out, size, threads);
+}
+
+// Дешифрование CFB без цепочки: поток ключей блока i - E(C[i-1]), а весь
+// шифротекст уже известен. Куски по 64 блока: входы AES (feedback и блоки
+// шифротекста со сдвигом на один) копируются в локальный буфер и шифруются
+// одним вызовом encryptBlocks - у AES-NI это 8 блоков в конвейере. Копия
+// входов позволяет писать результат поверх шифротекста (in == out).
+void cfbDecryptBlocks(const AESBackend& backend, const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out,
+                      size_t size, AESBlock& feedback) {
+    constexpr size_t chunkBlocks = 64;
+    alignas(16) uint8_t inputs[16 * chunkBlocks], keystream[16 * chunkBlocks];
+    for (size_t pos = 0; pos < size; pos += 16 * chunkBlocks) {
+        const size_t n = min(16 * chunkBlocks, size - pos), blocks = (n + 15) / 16;
+        memcpy(inputs, feedback.data(), 16);
+        memcpy(inputs + 16, in + pos, 16 * (blocks - 1));
+        // Обратная связь для следующего куска - его последний блок шифротекста;
+        // у неполного блока заменяются только имеющиеся байты предыдущего, как в cfbEncrypt
+        if (blocks >= 2) memcpy(feedback.data(), in + pos + 16 * (blocks - 2), 16);
+        memcpy(feedback.data(), in + pos + 16 * (blocks - 1), n - 16 * (blocks - 1));
+        backend.encryptBlocks(schedule, inputs, keystream, blocks);
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8) {
+            uint64_t c, k;
+            memcpy(&c, in + pos + j, 8);
+            memcpy(&k, keystream + j, 8);
+            c ^= k;
+            memcpy(out + pos + j, &c, 8);
         }
+        for (; j < n; ++j) out[pos + j] = in[pos + j] ^ keystream[j];
+    }
+}
+
+// Число потоков для size байт: threads, если задано, иначе по ядрам, но не
+// меньше 1 МБ на поток - меньше запуск потока дороже работы; не больше блоков
+int aesThreadCount(size_t size, int threads) {
+    constexpr size_t minBytesPerThread = 1 << 20;
+    if (threads <= 0) {
+        const unsigned hw = thread::hardware_concurrency();
+        threads = (int)min<size_t>(hw == 0 ? 1 : hw, size / minBytesPerThread);
+    }
+    return (int)max<size_t>(1, min<size_t>(threads, (size + 15) / 16));
+}
+
+// То же по потокам: блоки делятся на диапазоны, и каждому потоку нужен только
+// последний блок шифротекста перед своим диапазоном. Эти блоки запоминаются до
+// запуска потоков, поэтому дешифровать можно и на месте.
+void cfbDecryptParallel(const AESBackend& backend, const AESKeySchedule& schedule, const uint8_t* in, uint8_t* out,
+                        size_t size, AESBlock& feedback, int threads) {
+    const size_t blocks = (size + 15) / 16;
+    threads = aesThreadCount(size, threads);
+    if (threads == 1) {
+        cfbDecryptBlocks(backend, schedule, in, out, size, feedback);
+        return;
+    }
+    vector<size_t> first(threads + 1);
+    vector<AESBlock> feedbacks(threads);
+    for (int t = 0; t <= threads; ++t) first[t] = blocks * t / threads;
+    feedbacks[0] = feedback;
+    for (int t = 1; t < threads; ++t) copy_n(in + 16 * (first[t] - 1), 16, feedbacks[t].begin());
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&, t] {
+            const size_t from = 16 * first[t], to = min(size, 16 * first[t + 1]);
+            cfbDecryptBlocks(backend, schedule, in + from, out + from, to - from, feedbacks[t]);
+        });
+    for (thread& w : workers) w.join();
+    feedback = feedbacks[threads - 1];
+}
+
+// Функции режима CFB. Подробный вывод идет через справочный cfbReference
+// с трассировкой, без него - через быстрое ядро
+vector<uint8_t> encryptCFB(const vector<uint8_t>& plaintext, const AESKey& key, const AES_IV& iv, bool verbose) {
+    if (plaintext.empty()) return {};
+
+    if (!verbose) {
+        vector<uint8_t> ciphertext(plaintext.size());
+        AESBlock currentFeedback = iv;
+        AESContext(key).cfbEncrypt(plaintext.data(), ciphertext.data(), plaintext.size(), currentFeedback);
+        return ciphertext;
     }
+
+    AESTrace trace((plaintext.size() + 15) / 16, roundsForKeySize(key.size()));
+    vector<uint8_t> ciphertext = cfbReference(plaintext, key, iv, false, trace);
+    trace.dump(cout, false);
     return ciphertext;
 }
 
 vector<uint8_t> decryptCFB(const vector<uint8_t>& ciphertext, const AESKey& key, const AES_IV& iv, bool verbose) {
     if (ciphertext.empty()) return {};
 
+    if (!verbose) {
+        vector<uint8_t> decryptedtext(ciphertext.size());
+        AESBlock currentFeedback = iv;
+        AESContext(key).cfbDecrypt(ciphertext.data(), decryptedtext.data(), ciphertext.size(), currentFeedback);
+        return decryptedtext;
+    }
+
+    AESTrace trace((ciphertext.size() + 15) / 16, roundsForKeySize(key.size()));
+    vector<uint8_t> decryptedtext = cfbReference(ciphertext, key, iv, true, trace);
+    trace.dump(cout, true);
+    return decryptedtext;
+}
+
+// Справочный CFB на encryptBlock, по блоку за шаг. Обратная связь - всегда
+// шифротекст: выход при шифровании, вход при дешифровании
+template <class Trace>
+vector<uint8_t> cfbReference(const vector<uint8_t>& input, const AESKey& key, const AES_IV& iv, bool decrypt, Trace& trace) {
     ExpandedAESKey expandedKey;
-    keyExpansion(expandedKey, key, verbose);
+    keyExpansion(expandedKey, key);
+    const int rounds = roundsForKeySize(key.size());
+    for (int round = 0; round <= rounds; ++round) trace.bytes(TraceEvent::RoundKey, round, expandedKey.data() + 16 * round, 16);
+    trace.bytes(TraceEvent::IV, 0, iv.data(), iv.size());
 
-    vector<uint8_t> decryptedtext(ciphertext.size());
-    AESBlock currentFeedback = iv;
+    vector<uint8_t> output(input.size());
+    AESBlock feedback = iv;
+    for (size_t i = 0; i < input.size(); i += 16) {
+        trace.beginBlock(i / 16);
+        trace.bytes(TraceEvent::Feedback, 0, feedback.data(), feedback.size());
+        AESState state = blockToState(feedback);
+        encryptBlock(state, expandedKey, rounds, trace);
+        const AESBlock keystream = stateToBlock(state);
+        trace.bytes(TraceEvent::Keystream, 0, keystream.data(), keystream.size());
 
-    if (verbose) {
-        cout << "Начальный IV (Feedback): "; printBlockHex(iv);
+        const size_t n = min<size_t>(16, input.size() - i);
+        trace.bytes(TraceEvent::Input, 0, input.data() + i, n);
+        for (size_t j = 0; j < n; ++j) {
+            output[i + j] = input[i + j] ^ keystream[j];
+            feedback[j] = decrypt ? input[i + j] : output[i + j];
+        }
+        trace.bytes(TraceEvent::Output, 0, output.data() + i, n);
     }
-    
-    for (size_t i = 0; i < ciphertext.size(); i += 16) {
-        if (verbose) {
-            cout << "\nБлок " << (i / 16) + 1 << " (Дешифрование CFB):\n";
-            cout << "  Текущий блок обратной связи (вход для AES): "; printBlockHex(currentFeedback);
+    secureWipe(expandedKey.data(), expandedKey.size());
+    return output;
+}
+
+// Буфер рассчитан ровно на cfbReference: раундовые ключи, IV и записи блоков
+AESTrace::AESTrace(size_t blocks, int rounds)
+    : records((size_t)rounds + 2 + blocks * recordsPerBlock(rounds)), rounds(rounds) {}
+
+TraceRecord& AESTrace::next() {
+    if (used == records.size()) throw logic_error("Буфер трассировки AES переполнен");
+    TraceRecord& record = records[used++];
+    record.block = currentBlock;
+    return record;
+}
+
+void AESTrace::state(TraceEvent event, int round, const AESState& s) {
+    TraceRecord& record = next();
+    record.event = event;
+    record.round = (uint8_t)round;
+    record.length = 16;
+    for (int i = 0; i < 16; ++i) record.data[i] = s[i % 4][i / 4];
+}
+
+void AESTrace::bytes(TraceEvent event, int round, const uint8_t* data, size_t size) {
+    TraceRecord& record = next();
+    record.event = event;
+    record.round = (uint8_t)round;
+    record.length = (uint8_t)size;
+    copy_n(data, size, record.data.begin());
+}
+
+// Текст трассировки - тот же, что печатался по ходу шифрования. Байты
+// переводятся в hex по таблице, каждая строка выводится целиком
+void AESTrace::dump(ostream& out, bool decrypt) const {
+    static const char digits[] = "0123456789abcdef";
+    string line;
+    auto appendByte = [&](uint8_t b) {
+        line += digits[b >> 4];
+        line += digits[b & 15];
+        line += ' ';
+    };
+    auto appendBytes = [&](const TraceRecord& record) {
+        for (int i = 0; i < record.length; ++i) appendByte(record.data[i]);
+        line += '\n';
+    };
+    auto appendState = [&](const TraceRecord& record) {
+        for (int r = 0; r < Nb; ++r) {
+            line += "    ";
+            for (int c = 0; c < Nb; ++c) appendByte(record.data[c * 4 + r]);
+            line += '\n';
+        }
+    };
+
+    for (size_t i = 0; i < used; ++i) {
+        const TraceRecord& record = records[i];
+        const string round = to_string(record.round);
+        line.clear();
+        switch (record.event) {
+        case TraceEvent::RoundKey:
+            line = "Раунд " + string(record.round < 10 ? " " : "") + round + ": ";
+            appendBytes(record);
+            if (record.round == rounds) line += '\n';
+            break;
+        case TraceEvent::IV:
+            line = "Начальный IV (Feedback): ";
+            appendBytes(record);
+            break;
+        case TraceEvent::Feedback:
+            line = "\nБлок " + to_string(record.block + 1) + (decrypt ? " (Дешифрование CFB):\n" : " (Шифрование CFB):\n");
+            line += "  Текущий блок обратной связи (вход для AES): ";
+            appendBytes(record);
+            break;
+        case TraceEvent::Initial:
+            line = "  Начальное состояние блока (до AddRoundKey 0):\n";
+            appendState(record);
+            break;
+        case TraceEvent::AddRoundKey:
+            line = record.round == rounds ? "  Финальное состояние блока (после всех раундов):\n"
+                                          : "  После AddRoundKey (Раунд " + round + "):\n";
+            appendState(record);
+            break;
+        case TraceEvent::SubBytes:
+            line = record.round == rounds ? "  После финального SubBytes:\n" : "  После SubBytes (Раунд " + round + "):\n";
+            appendState(record);
+            break;
+        case TraceEvent::ShiftRows:
+            line = record.round == rounds ? "  После финального ShiftRows:\n" : "  После ShiftRows (Раунд " + round + "):\n";
+            appendState(record);
+            break;
+        case TraceEvent::MixColumns:
+            line = "  После MixColumns (Раунд " + round + "):\n";
+            appendState(record);
+            break;
+        case TraceEvent::Keystream:
+            line = "  Сгенерированный поток ключей (выход AES): ";
+            appendBytes(record);
+            break;
+        case TraceEvent::Input:
+            line = decrypt ? "  Зашифрованный блок (XOR с потоком ключей): " : "  Исходный блок (XOR с потоком ключей): ";
+            appendBytes(record);
+            break;
+        case TraceEvent::Output:
+            line = decrypt ? "  Полученный расшифрованный блок: " : "  Полученный зашифрованный блок: ";
+            appendBytes(record);
+            break;
         }
+        out << line;
+    }
+    out.flush();
+}
 
-        AESState state = blockToState(currentFeedback);
-        encryptBlock(state, expandedKey, verbose);
-        AESBlock keystreamBlock = stateToBlock(state);
+// Функции режимов CTR и GCM. Блоки шифруются независимо, поэтому данные
+// делятся между потоками, а внутри потока идут кусками по 64 блока через
+// encryptBlocks, как при дешифровании CFB.
 
-        if (verbose) {
-            cout << "  Сгенерированный поток ключей (выход AES): "; printBlockHex(keystreamBlock);
-            cout << "  Зашифрованный блок (XOR с потоком ключей): ";
-            for (size_t j = 0; j < min<size_t>(16, ciphertext.size() - i); ++j) {
-                cout << hex << setw(2) << setfill('0') << static_cast<int>(ciphertext[i+j]) << " ";
-            }
-            cout << dec << "\n";
+// Счетчик + n: в CTR - весь блок как 128-битное число big-endian, в GCM
+// (low32) - только младшие 32 бита по модулю 2^32 (inc32 из SP 800-38D)
+AESBlock addToCounter(const AESBlock& counter, uint64_t n, bool low32) {
+    AESBlock result = counter;
+    if (low32) {
+        const uint32_t low = loadBigEndian(counter.data() + 12) + (uint32_t)n;
+        storeBigEndian(result.data() + 12, low);
+        return result;
+    }
+    uint64_t carry = n;
+    for (int i = 15; i >= 0 && carry != 0; --i) {
+        carry += result[i];
+        result[i] = (uint8_t)carry;
+        carry >>= 8;
+    }
+    return result;
+}
+
+void ctrCryptBlocks(const AESBackend& backend, const AESKeySchedule& schedule, const AESBlock& counter,
+                    const uint8_t* in, uint8_t* out, size_t size, bool low32) {
+    constexpr size_t chunkBlocks = 64;
+    alignas(16) uint8_t counters[16 * chunkBlocks], keystream[16 * chunkBlocks];
+    // Счетчик держится как два 64-битных числа, в блок пишется в big-endian
+    uint64_t hi = (uint64_t)loadBigEndian(counter.data()) << 32 | loadBigEndian(counter.data() + 4);
+    uint64_t lo = (uint64_t)loadBigEndian(counter.data() + 8) << 32 | loadBigEndian(counter.data() + 12);
+    for (size_t pos = 0; pos < size; pos += 16 * chunkBlocks) {
+        const size_t n = min(16 * chunkBlocks, size - pos), blocks = (n + 15) / 16;
+        for (size_t b = 0; b < blocks; ++b) {
+            const uint64_t words[2] = {__builtin_bswap64(hi), __builtin_bswap64(lo)};
+            memcpy(counters + 16 * b, words, 16);
+            if (low32) lo = (lo & 0xFFFFFFFF00000000ULL) | (uint32_t)(lo + 1);
+            else if (++lo == 0) ++hi;
+        }
+        backend.encryptBlocks(schedule, counters, keystream, blocks);
+        size_t j = 0;
+        for (; j + 8 <= n; j += 8) {
+            uint64_t d, k;
+            memcpy(&d, in + pos + j, 8);
+            memcpy(&k, keystream + j, 8);
+            d ^= k;
+            memcpy(out + pos + j, &d, 8);
         }
+        for (; j < n; ++j) out[pos + j] = in[pos + j] ^ keystream[j];
+    }
+}
+
+// Поток t начинает со счетчика counter + (первый блок t) - потоки не связаны
+void ctrCryptParallel(const AESBackend& backend, const AESKeySchedule& schedule, const AESBlock& counter,
+                      const uint8_t* in, uint8_t* out, size_t size, int threads, bool low32) {
+    threads = aesThreadCount(size, threads);
+    const size_t blocks = (size + 15) / 16;
+    vector<thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        const size_t first = blocks * t / threads, from = 16 * first, to = min(size, 16 * (blocks * (t + 1) / threads));
+        auto work = [&, first, from, to] {
+            ctrCryptBlocks(backend, schedule, addToCounter(counter, first, low32), in + from, out + from, to - from, low32);
+        };
+        if (t + 1 < threads) workers.emplace_back(work);
+        else work();
+    }
+    for (thread& w : workers) w.join();
+}
+
+// Умножение в GF(2^128) по определению (SP 800-38D, алгоритм 1): биты идут от
+// старшего бита байта 0, сдвиг вправо с приведением по 0xE1. Медленно, нужно
+// только для степеней H и как эталон в проверке.
+AESBlock gf128Mul(const AESBlock& x, const AESBlock& y) {
+    AESBlock z = {}, v = y;
+    for (int i = 0; i < 128; ++i) {
+        if (x[i / 8] >> (7 - i % 8) & 1)
+            for (int j = 0; j < 16; ++j) z[j] ^= v[j];
+        const bool lsb = v[15] & 1;
+        for (int j = 15; j > 0; --j) v[j] = (uint8_t)(v[j] >> 1 | v[j - 1] << 7);
+        v[0] >>= 1;
+        if (lsb) v[0] ^= 0xE1;
+    }
+    return z;
+}
+
+AESBlock gf128Pow(const AESBlock& h, uint64_t k) {
+    AESBlock result = {}, base = h;
+    result[0] = 0x80; // Единица поля: старший бит байта 0
+    for (; k > 0; k >>= 1) {
+        if (k & 1) result = gf128Mul(result, base);
+        base = gf128Mul(base, base);
+    }
+    return result;
+}
+
+void makeGHashKey(GHashKey& key, const AESBackend& backend, const AESKeySchedule& schedule) {
+    const AESBlock zero = {};
+    backend.encryptBlocks(schedule, zero.data(), key.powers[0].data(), 1);
+    for (int i = 1; i < 4; ++i) key.powers[i] = gf128Mul(key.powers[i - 1], key.powers[0]);
 
-        AESBlock nextFeedbackBlock;
-        const size_t bytesToProcess = min<size_t>(16, ciphertext.size() - i);
-        copy(ciphertext.begin() + i, ciphertext.begin() + i + bytesToProcess, nextFeedbackBlock.begin());
-        
-        for (size_t j = 0; j < bytesToProcess; ++j) {
-            decryptedtext[i + j] = ciphertext[i + j] ^ keystreamBlock[j];
+    // Таблицы Шоупа: hh/hl[i] - старшая и младшая половины i * H для 4-битного i
+    uint64_t vh = 0, vl = 0;
+    for (int i = 0; i < 8; ++i) {
+        vh = vh << 8 | key.powers[0][i];
+        vl = vl << 8 | key.powers[0][8 + i];
+    }
+    key.hh[0] = key.hl[0] = 0;
+    key.hh[8] = vh;
+    key.hl[8] = vl;
+    for (int i = 4; i > 0; i >>= 1) {
+        const uint64_t reduce = (vl & 1) ? 0xE100000000000000ULL : 0;
+        vl = vh << 63 | vl >> 1;
+        vh = vh >> 1 ^ reduce;
+        key.hh[i] = vh;
+        key.hl[i] = vl;
+    }
+    for (int i = 2; i <= 8; i *= 2)
+        for (int j = 1; j < i; ++j) {
+            key.hh[i + j] = key.hh[i] ^ key.hh[j];
+            key.hl[i + j] = key.hl[i] ^ key.hl[j];
         }
-        
-        currentFeedback = nextFeedbackBlock;
+}
 
-        if (verbose) {
-            cout << "  Полученный расшифрованный блок: ";
-            for (size_t j = 0; j < bytesToProcess; ++j) {
-                cout << hex << setw(2) << setfill('0') << static_cast<int>(decryptedtext[i+j]) << " ";
+// Программный GHASH: умножение на H по 4 бита за шаг через таблицы
+void ghashUpdateTable(const GHashKey& key, AESBlock& x, const uint8_t* data, size_t size) {
+    static const uint64_t last4[16] = {0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+                                       0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0};
+    for (size_t pos = 0; pos < size; pos += 16) {
+        const size_t n = min<size_t>(16, size - pos);
+        for (size_t j = 0; j < n; ++j) x[j] ^= data[pos + j];
+        uint8_t lo = x[15] & 0xF;
+        uint64_t zh = key.hh[lo], zl = key.hl[lo];
+        for (int i = 15; i >= 0; --i) {
+            lo = x[i] & 0xF;
+            const uint8_t hi = x[i] >> 4;
+            if (i != 15) {
+                const uint8_t rem = zl & 0xF;
+                zl = zh << 60 | zl >> 4;
+                zh = zh >> 4 ^ last4[rem] << 48;
+                zh ^= key.hh[lo];
+                zl ^= key.hl[lo];
             }
-            cout << dec << "\n";
+            const uint8_t rem = zl & 0xF;
+            zl = zh << 60 | zl >> 4;
+            zh = zh >> 4 ^ last4[rem] << 48;
+            zh ^= key.hh[hi];
+            zl ^= key.hl[hi];
         }
+        storeBigEndian(x.data(), (uint32_t)(zh >> 32));
+        storeBigEndian(x.data() + 4, (uint32_t)zh);
+        storeBigEndian(x.data() + 8, (uint32_t)(zl >> 32));
+        storeBigEndian(x.data() + 12, (uint32_t)zl);
     }
-    return decryptedtext;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+bool cpuHasPCLMUL() {
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+}
+
+// Произведение в GF(2^128) на pclmulqdq (Intel, "Carry-Less Multiplication
+// Instruction and its Usage for Computing the GCM Mode", алгоритм 5): четыре
+// умножения 64x64, сдвиг на бит из-за отраженного порядка битов и приведение
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i gfMulPCLMUL(__m128i a, __m128i b) {
+    __m128i lo = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+    __m128i hi = _mm_clmulepi64_si128(a, b, 0x11);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    __m128i carryLo = _mm_srli_epi32(lo, 31), carryHi = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    const __m128i crossing = _mm_srli_si128(carryLo, 12);
+    hi = _mm_or_si128(_mm_or_si128(hi, _mm_slli_si128(carryHi, 4)), crossing);
+    lo = _mm_or_si128(lo, _mm_slli_si128(carryLo, 4));
+
+    __m128i t = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    const __m128i spill = _mm_srli_si128(t, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+    t = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+    t = _mm_xor_si128(t, spill);
+    return _mm_xor_si128(hi, _mm_xor_si128(lo, t));
+}
+
+// Блок в порядке битов GHASH: байты разворачиваются, чтобы старший бит поля
+// оказался в старшем бите регистра
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i loadGHashBlock(const uint8_t* p) {
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), reverse);
+}
+
+// Четыре блока за шаг: x = (x ^ B1) H^4 ^ B2 H^3 ^ B3 H^2 ^ B4 H - четыре
+// независимых умножения идут в конвейере вместо цепочки из четырех
+__attribute__((target("pclmul,ssse3")))
+void ghashUpdatePCLMUL(const GHashKey& key, AESBlock& x, const uint8_t* data, size_t size) {
+    const __m128i h1 = loadGHashBlock(key.powers[0].data()), h2 = loadGHashBlock(key.powers[1].data());
+    const __m128i h3 = loadGHashBlock(key.powers[2].data()), h4 = loadGHashBlock(key.powers[3].data());
+    __m128i acc = loadGHashBlock(x.data());
+    size_t pos = 0;
+    for (; pos + 64 <= size; pos += 64) {
+        const __m128i b1 = _mm_xor_si128(acc, loadGHashBlock(data + pos));
+        acc = _mm_xor_si128(_mm_xor_si128(gfMulPCLMUL(b1, h4), gfMulPCLMUL(loadGHashBlock(data + pos + 16), h3)),
+                            _mm_xor_si128(gfMulPCLMUL(loadGHashBlock(data + pos + 32), h2), gfMulPCLMUL(loadGHashBlock(data + pos + 48), h1)));
+    }
+    for (; pos < size; pos += 16) {
+        AESBlock block = {};
+        memcpy(block.data(), data + pos, min<size_t>(16, size - pos));
+        acc = gfMulPCLMUL(_mm_xor_si128(acc, loadGHashBlock(block.data())), h1);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(x.data()), _mm_shuffle_epi8(acc, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)));
+}
+#endif
+
+vector<GHashBackend> availableGHashBackends() {
+    vector<GHashBackend> backends;
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpuHasPCLMUL()) backends.push_back({"PCLMUL", ghashUpdatePCLMUL});
+#endif
+    backends.push_back({"таблицы", ghashUpdateTable});
+    return backends;
+}
+
+const GHashBackend& activeGHashBackend() {
+    static const GHashBackend backend = availableGHashBackends().front();
+    return backend;
+}
+
+// GCM (NIST SP 800-38D). Поток t шифрует свой диапазон CTR и сразу считает
+// по нему частичный GHASH Y_t кусками по 4 КБ, пока данные в кеше. Затем
+// частичные суммы сводятся: GHASH линеен, и продолжение с состояния X после
+// k блоков равно X * H^k ^ Y_t. Возвращает тег; in и out могут совпадать.
+AESBlock gcmCrypt(const AESBackend& backend, const GHashBackend& ghash, const AESKeySchedule& schedule,
+                  const uint8_t* iv, size_t ivSize, const uint8_t* aad, size_t aadSize,
+                  const uint8_t* in, uint8_t* out, size_t size, bool encrypt, int threads) {
+    if (ivSize == 0) throw invalid_argument("IV для GCM не может быть пустым");
+    // Пределы SP 800-38D, 5.2.1.1. Текст - не больше 2^32 - 2 блоков: дальше
+    // 32-битный счетчик вернулся бы к J0, и поток ключей повторил бы маску
+    // тега E(J0). Длины AAD и IV в битах должны помещаться в 64 бита.
+    const uint64_t maxTextBytes = ((1ULL << 32) - 2) * 16, maxLengthBytes = (1ULL << 61) - 1;
+    if ((uint64_t)size > maxTextBytes)
+        throw invalid_argument("Данные для GCM длиннее 2^32 - 2 блоков: " + to_string(size) + " байт");
+    if ((uint64_t)aadSize > maxLengthBytes || (uint64_t)ivSize > maxLengthBytes)
+        throw invalid_argument("AAD или IV для GCM длиннее 2^64 - 1 бит");
+    GHashKey hashKey;
+    makeGHashKey(hashKey, backend, schedule);
+
+    // J0: для 96-битного IV - IV || 0^31 || 1, иначе GHASH от IV с длиной
+    AESBlock j0 = {};
+    if (ivSize == 12) {
+        memcpy(j0.data(), iv, 12);
+        j0[15] = 1;
+    } else {
+        ghash.update(hashKey, j0, iv, ivSize);
+        AESBlock lengths = {};
+        storeBigEndian(lengths.data() + 8, (uint32_t)((uint64_t)ivSize * 8 >> 32));
+        storeBigEndian(lengths.data() + 12, (uint32_t)((uint64_t)ivSize * 8));
+        ghash.update(hashKey, j0, lengths.data(), 16);
+    }
+
+    threads = aesThreadCount(size, threads);
+    const size_t blocks = (size + 15) / 16;
+    vector<size_t> first(threads + 1);
+    for (int t = 0; t <= threads; ++t) first[t] = blocks * t / threads;
+    vector<AESBlock> partial(threads);
+    auto work = [&](int t) {
+        constexpr size_t chunk = 4096;
+        const size_t from = 16 * first[t], to = min(size, 16 * first[t + 1]);
+        const AESBlock counter = addToCounter(j0, 1 + first[t], true);
+        AESBlock y = {};
+        for (size_t pos = from; pos < to; pos += chunk) {
+            const size_t n = min(chunk, to - pos);
+            if (!encrypt) ghash.update(hashKey, y, in + pos, n); // До записи: возможно, out == in
+            ctrCryptBlocks(backend, schedule, addToCounter(counter, (pos - from) / 16, true), in + pos, out + pos, n, true);
+            if (encrypt) ghash.update(hashKey, y, out + pos, n);
+        }
+        partial[t] = y;
+    };
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(work, t);
+    work(0);
+    for (thread& w : workers) w.join();
+
+    AESBlock x = {};
+    ghash.update(hashKey, x, aad, aadSize);
+    for (int t = 0; t < threads; ++t) {
+        x = gf128Mul(x, gf128Pow(hashKey.powers[0], first[t + 1] - first[t]));
+        for (int j = 0; j < 16; ++j) x[j] ^= partial[t][j];
+    }
+    AESBlock lengths;
+    const uint64_t aadBits = (uint64_t)aadSize * 8, dataBits = (uint64_t)size * 8;
+    storeBigEndian(lengths.data(), (uint32_t)(aadBits >> 32));
+    storeBigEndian(lengths.data() + 4, (uint32_t)aadBits);
+    storeBigEndian(lengths.data() + 8, (uint32_t)(dataBits >> 32));
+    storeBigEndian(lengths.data() + 12, (uint32_t)dataBits);
+    ghash.update(hashKey, x, lengths.data(), 16);
+
+    AESBlock tag;
+    backend.encryptBlocks(schedule, j0.data(), tag.data(), 1);
+    for (int j = 0; j < 16; ++j) tag[j] ^= x[j];
+    return tag;
+}
+
+vector<uint8_t> encryptCTR(const vector<uint8_t>& plaintext, const AESKey& key, const AES_IV& iv) {
+    vector<uint8_t> ciphertext(plaintext.size());
+    AESContext(key).ctrCrypt(iv, plaintext.data(), ciphertext.data(), plaintext.size());
+    return ciphertext;
+}
+
+// CTR симметричен: дешифрование - то же наложение потока ключей
+vector<uint8_t> decryptCTR(const vector<uint8_t>& ciphertext, const AESKey& key, const AES_IV& iv) {
+    return encryptCTR(ciphertext, key, iv);
+}
+
+vector<uint8_t> encryptGCM(const vector<uint8_t>& plaintext, const AESKey& key, const vector<uint8_t>& iv,
+                           const vector<uint8_t>& aad, AESBlock& tag) {
+    const AESContext context(key);
+    vector<uint8_t> ciphertext(plaintext.size());
+    tag = gcmCrypt(context.backend(), activeGHashBackend(), context.schedule(), iv.data(), iv.size(), aad.data(), aad.size(),
+                   plaintext.data(), ciphertext.data(), plaintext.size(), true);
+    return ciphertext;
+}
+
+// Тег сравнивается без раннего выхода, чтобы время не выдавало число
+// совпавших байт; при несовпадении расшифровка не возвращается
+vector<uint8_t> decryptGCM(const vector<uint8_t>& ciphertext, const AESKey& key, const vector<uint8_t>& iv,
+                           const vector<uint8_t>& aad, const AESBlock& tag) {
+    const AESContext context(key);
+    vector<uint8_t> plaintext(ciphertext.size());
+    const AESBlock expected = gcmCrypt(context.backend(), activeGHashBackend(), context.schedule(), iv.data(), iv.size(),
+                                       aad.data(), aad.size(), ciphertext.data(), plaintext.data(), ciphertext.size(), false);
+    uint8_t difference = 0;
+    for (int j = 0; j < 16; ++j) difference |= expected[j] ^ tag[j];
+    if (difference != 0) throw runtime_error("Тег GCM не совпал: данные или ключ повреждены");
+    return plaintext;
 }
 
 // Функции для работы с файлами
@@ -404,6 +1549,217 @@ void writeToFile(const string& filename, const vector<uint8_t>& data) {
     cout << "Успешно записано " << data.size() << " байт в файл: " << filename << endl;
 }
 
+// Два пути ведут к одному файлу - тот же путь, другая запись пути,
+// символическая или жесткая ссылка: совпадают устройство и inode.
+// Несуществующий файл ни с чем не совпадает.
+bool sameFile(const string& first, const string& second) {
+    struct stat a, b;
+    if (stat(first.c_str(), &a) != 0 || stat(second.c_str(), &b) != 0) return false;
+    return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+// Потоковое шифрование файла любого размера: память - три куска по chunkSize
+// байт. Пока кусок i шифруется, кусок i + 1 читается, а кусок i - 1 пишется
+// фоновыми задачами; каждый буфер по кругу проходит чтение, шифрование на
+// месте и запись. Обратная связь CFB и счетчик CTR переходят между кусками,
+// поэтому результат совпадает с шифрованием файла целиком. Если выход - тот
+// же файл, что и вход, открытие выхода обрезало бы вход; такой файл
+// шифруется на месте через mmap.
+uint64_t cryptFileStream(const string& inputName, const string& outputName, const AESKey& key, const AES_IV& iv,
+                         AESMode mode, bool encrypt, size_t chunkSize) {
+    if (mode == AESMode::GCM) throw invalid_argument("Потоковая обработка поддерживает только CFB и CTR");
+    if (sameFile(inputName, outputName)) return cryptFileMapped(inputName, "", key, iv, mode, encrypt);
+    chunkSize = max<size_t>(16, (chunkSize + 15) / 16 * 16); // Обратная связь CFB - целые блоки
+    ifstream ifs(inputName, ios::binary);
+    if (!ifs) throw runtime_error("Не удалось открыть файл для чтения: " + inputName);
+    ofstream ofs(outputName, ios::binary);
+    if (!ofs) throw runtime_error("Не удалось открыть файл для записи: " + outputName);
+
+    const AESContext context(key);
+    AESBlock feedback = iv;
+    uint64_t offset = 0;
+
+    vector<vector<uint8_t>> buffers(3, vector<uint8_t>(chunkSize));
+    auto readChunk = [&](vector<uint8_t>& buffer) {
+        ifs.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+        if (ifs.bad()) throw runtime_error("Не удалось прочитать данные из файла: " + inputName);
+        return (size_t)ifs.gcount();
+    };
+    auto writeChunk = [&](const vector<uint8_t>& buffer, size_t n) {
+        if (!ofs.write(reinterpret_cast<const char*>(buffer.data()), n))
+            throw runtime_error("Не удалось записать данные в файл: " + outputName);
+    };
+
+    size_t n = readChunk(buffers[0]);
+    future<void> pendingWrite;
+    for (size_t i = 0; n > 0; ++i) {
+        vector<uint8_t>& current = buffers[i % 3];
+        // Следующий буфер последний раз писался на шаге i - 2, запись уже дождались
+        future<size_t> pendingRead;
+        if (n == chunkSize) pendingRead = async(launch::async, readChunk, ref(buffers[(i + 1) % 3]));
+
+        if (mode == AESMode::CTR) context.ctrCrypt(addToCounter(iv, offset / 16, false), current.data(), current.data(), n);
+        else if (encrypt) context.cfbEncrypt(current.data(), current.data(), n, feedback);
+        else context.cfbDecrypt(current.data(), current.data(), n, feedback);
+        offset += n;
+
+        if (pendingWrite.valid()) pendingWrite.get();
+        pendingWrite = async(launch::async, writeChunk, cref(current), n);
+        n = pendingRead.valid() ? pendingRead.get() : 0;
+    }
+    if (pendingWrite.valid()) pendingWrite.get();
+    ofs.close();
+    if (!ofs) throw runtime_error("Не удалось записать данные в файл: " + outputName);
+    cout << "Успешно " << (encrypt ? "зашифровано " : "расшифровано ") << offset << " байт потоком: "
+         << inputName << " -> " << outputName << endl;
+    return offset;
+}
+
+// Шифрование через mmap без копий: ядра CFB/CTR читают прямо из отображения
+// входного файла и пишут в отображение выходного, заранее растянутого до того
+// же размера. Пустое имя выхода или выход, который по sameFile оказывается
+// тем же файлом (другая запись пути, ссылка), - шифрование на месте,
+// шифротекст перезаписывает открытый текст. Создание выхода обрезало бы вход. Файл идет окнами по 64 МБ,
+// после окна его страницы отпускаются, как в потоковом режиме.
+uint64_t cryptFileMapped(const string& inputName, const string& outputName, const AESKey& key, const AES_IV& iv,
+                         AESMode mode, bool encrypt) {
+    if (mode == AESMode::GCM) throw invalid_argument("Обработка через mmap поддерживает только CFB и CTR");
+    const bool inPlace = outputName.empty() || sameFile(inputName, outputName);
+    const MappedFile input(inputName, inPlace ? MappedFile::Access::ReadWrite : MappedFile::Access::Read);
+    unique_ptr<MappedFile> output;
+    if (!inPlace) output = make_unique<MappedFile>(outputName, MappedFile::Access::Create, input.size());
+    const uint8_t* in = input.data();
+    uint8_t* out = inPlace ? input.data() : output->data();
+
+    const AESContext context(key);
+    AESBlock feedback = iv;
+    constexpr size_t window = 64 << 20;
+    for (size_t pos = 0; pos < input.size(); pos += window) {
+        const size_t n = min(window, input.size() - pos);
+        if (mode == AESMode::CTR) context.ctrCrypt(addToCounter(iv, pos / 16, false), in + pos, out + pos, n);
+        else if (encrypt) context.cfbEncrypt(in + pos, out + pos, n, feedback);
+        else context.cfbDecrypt(in + pos, out + pos, n, feedback);
+        input.release(pos, pos + n);
+        if (output) output->release(pos, pos + n);
+    }
+    cout << "Успешно " << (encrypt ? "зашифровано " : "расшифровано ") << input.size() << " байт через mmap: " << inputName
+         << (inPlace ? " (на месте)" : " -> " + outputName) << endl;
+    return input.size();
+}
+
+// Пакетный режим. Для тысяч мелких файлов дороже всего запуск процесса и
+// расширение ключа, поэтому задания манифеста разбирает фиксированный пул
+// потоков. Расписания ключей берутся из общего кеша, так что повторяющийся
+// ключ расширяется один раз на весь пакет; поток держит контекст последнего
+// ключа и свой буфер, выделенный один раз. Большие файлы идут через буфер
+// кусками с переносом обратной связи и счетчика.
+
+vector<uint8_t> parseHexBytes(const string& text) {
+    if (text.size() % 2 != 0) throw invalid_argument("Нечетное число шестнадцатеричных цифр: " + text);
+    vector<uint8_t> bytes(text.size() / 2);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        const string byte = text.substr(2 * i, 2);
+        if (!isxdigit((unsigned char)byte[0]) || !isxdigit((unsigned char)byte[1]))
+            throw invalid_argument("Неверная шестнадцатеричная запись: " + text);
+        bytes[i] = (uint8_t)stoi(byte, nullptr, 16);
+    }
+    return bytes;
+}
+
+AESBlock parseHexBlock(const string& text) {
+    if (text.size() != 32) throw invalid_argument("Ожидается 32 шестнадцатеричные цифры: " + text);
+    const vector<uint8_t> bytes = parseHexBytes(text);
+    AESBlock block = {};
+    copy(bytes.begin(), bytes.end(), block.begin());
+    return block;
+}
+
+// Пустые строки и строки с # пропускаются
+vector<BatchJob> readBatchManifest(const string& path) {
+    ifstream ifs(path);
+    if (!ifs) throw runtime_error("Не удалось открыть манифест: " + path);
+    vector<BatchJob> jobs;
+    string line;
+    for (int number = 1; getline(ifs, line); ++number) {
+        istringstream fields(line);
+        BatchJob job;
+        string key, iv, mode, extra;
+        if (!(fields >> job.input) || job.input[0] == '#') continue;
+        if (!(fields >> job.output >> key >> iv))
+            throw invalid_argument("Манифест, строка " + to_string(number) + ": нужно \"вход выход ключ IV [cfb|ctr]\"");
+        fields >> mode;
+        if (fields >> extra) throw invalid_argument("Манифест, строка " + to_string(number) + ": лишнее поле " + extra);
+        if (mode == "ctr") job.mode = AESMode::CTR;
+        else if (!mode.empty() && mode != "cfb")
+            throw invalid_argument("Манифест, строка " + to_string(number) + ": режим должен быть cfb или ctr");
+        job.key = parseHexBytes(key);
+        if (job.key.size() != 16 && job.key.size() != 24 && job.key.size() != 32)
+            throw invalid_argument("Манифест, строка " + to_string(number) + ": ключ - 32, 48 или 64 шестнадцатеричные цифры");
+        job.iv = parseHexBlock(iv);
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// Задания раздаются по атомарному счетчику; ошибка одного задания попадает в
+// его результат и не останавливает остальные
+vector<BatchResult> runBatchJobs(const vector<BatchJob>& jobs, bool encrypt, int threads) {
+    if (threads <= 0) threads = max(1u, thread::hardware_concurrency());
+    threads = max(1, min<int>(threads, (int)jobs.size()));
+    vector<BatchResult> results(jobs.size());
+    atomic<size_t> next(0);
+
+    auto worker = [&] {
+        constexpr size_t bufferSize = 1 << 20;
+        vector<uint8_t> buffer(bufferSize);
+        unique_ptr<AESContext> context;
+        AESKey contextKey;
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            const BatchJob& job = jobs[i];
+            BatchResult& result = results[i];
+            const auto start = chrono::steady_clock::now();
+            try {
+                if (!context || contextKey != job.key) {
+                    context = make_unique<AESContext>(job.key);
+                    contextKey = job.key;
+                }
+                ifstream ifs(job.input, ios::binary);
+                if (!ifs) throw runtime_error("Не удалось открыть файл для чтения: " + job.input);
+                // Открытие выхода обрезало бы вход: такое задание - ошибка
+                if (sameFile(job.input, job.output))
+                    throw invalid_argument("Выход " + job.output + " - тот же файл, что и вход " + job.input);
+                ofstream ofs(job.output, ios::binary);
+                if (!ofs) throw runtime_error("Не удалось открыть файл для записи: " + job.output);
+                AESBlock feedback = job.iv;
+                for (;;) {
+                    ifs.read(reinterpret_cast<char*>(buffer.data()), bufferSize);
+                    if (ifs.bad()) throw runtime_error("Не удалось прочитать данные из файла: " + job.input);
+                    const size_t n = (size_t)ifs.gcount();
+                    if (n == 0) break;
+                    // Параллельны задания, поэтому внутри задания один поток
+                    if (job.mode == AESMode::CTR)
+                        context->ctrCrypt(addToCounter(job.iv, result.bytes / 16, false), buffer.data(), buffer.data(), n, 1);
+                    else if (encrypt) context->cfbEncrypt(buffer.data(), buffer.data(), n, feedback);
+                    else context->cfbDecrypt(buffer.data(), buffer.data(), n, feedback, 1);
+                    if (!ofs.write(reinterpret_cast<const char*>(buffer.data()), n))
+                        throw runtime_error("Не удалось записать данные в файл: " + job.output);
+                    result.bytes += n;
+                }
+            } catch (const exception& e) {
+                result.error = e.what();
+            }
+            result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        // Расписание затрет кеш, а копию ключа - поток сам
+        secureWipe(contextKey.data(), contextKey.size());
+    };
+    vector<thread> workers;
+    for (int t = 1; t < threads; ++t) workers.emplace_back(worker);
+    worker();
+    for (thread& w : workers) w.join();
+    return results;
+}
+
 AESBlock loadBlockFromFile(const string& filename) {
     ifstream ifs(filename, ios::binary);
     if (!ifs) throw runtime_error("Не удалось открыть файл для чтения: " + filename);
@@ -422,4 +1778,723 @@ void saveBlockToFile(const AESBlock& block, const string& filename) {
 void printBlockHex(const AESBlock& block) {
     for (const auto& byte : block) cout << hex << setw(2) << setfill('0') << static_cast<int>(byte) << " ";
     cout << dec << endl;
-}
\ No newline at end of file
+}
+
+// Ключ в файле - 16, 24 или 32 байта, длина файла задает вариант AES
+AESKey loadKeyFromFile(const string& filename) {
+    ifstream ifs(filename, ios::binary);
+    if (!ifs) throw runtime_error("Не удалось открыть файл для чтения: " + filename);
+    AESKey key(33);
+    ifs.read(reinterpret_cast<char*>(key.data()), key.size());
+    key.resize((size_t)ifs.gcount());
+    if (key.size() != 16 && key.size() != 24 && key.size() != 32)
+        throw runtime_error("Файл " + filename + " должен содержать ключ из 16, 24 или 32 байт.");
+    return key;
+}
+
+void saveKeyToFile(const AESKey& key, const string& filename) {
+    ofstream ofs(filename, ios::binary);
+    if (!ofs) throw runtime_error("Не удалось открыть файл для записи: " + filename);
+    ofs.write(reinterpret_cast<const char*>(key.data()), key.size());
+}
+
+void printKeyHex(const AESKey& key) {
+    for (const auto& byte : key) cout << hex << setw(2) << setfill('0') << static_cast<int>(byte) << " ";
+    cout << dec << endl;
+}
+
+// Самопроверка: векторы FIPS-197 (приложения B и C.1-C.3) для справочного и
+// быстрого ядер, совпадение быстрого CFB со справочным на случайных данных,
+// векторы CTR и GCM и совпадение их результатов при любом числе потоков
+bool checkAES() {
+    struct Vector { AESKey key; AESBlock plain, cipher; };
+    const Vector vectors[] = {
+        {{0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c},
+         {0x32, 0x43, 0xf6, 0xa8, 0x88, 0x5a, 0x30, 0x8d, 0x31, 0x31, 0x98, 0xa2, 0xe0, 0x37, 0x07, 0x34},
+         {0x39, 0x25, 0x84, 0x1d, 0x02, 0xdc, 0x09, 0xfb, 0xdc, 0x11, 0x85, 0x97, 0x19, 0x6a, 0x0b, 0x32}},
+        {{0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f},
+         {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff},
+         {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a}},
+        {{0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+          0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17},
+         {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff},
+         {0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91}},
+        {{0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+          0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f},
+         {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff},
+         {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89}}};
+    int failures = 0;
+    for (const Vector& v : vectors) {
+        ExpandedAESKey expandedKey;
+        keyExpansion(expandedKey, v.key);
+        AESState state = blockToState(v.plain);
+        encryptBlock(state, expandedKey, roundsForKeySize(v.key.size()));
+        AESKeySchedule schedule;
+        expandKeySchedule(schedule, v.key);
+        AESBlock fast;
+        encryptBlockFast(schedule, v.plain.data(), fast.data());
+        if (stateToBlock(state) != v.cipher || fast != v.cipher) ++failures;
+        for (const AESBackend& backend : availableAESBackends()) {
+            AESKeySchedule own;
+            backend.expandKey(own, v.key);
+            AESBlock out;
+            backend.encryptBlocks(own, v.plain.data(), out.data(), 1);
+            if (out != v.cipher || own.rounds != schedule.rounds || own.words != schedule.words || own.bytes != schedule.bytes) {
+                cout << "FIPS-197: расхождение в реализации " << backend.name << endl;
+                ++failures;
+            }
+        }
+    }
+    cout << "FIPS-197, AES-128/192/256 (";
+    for (const AESBackend& backend : availableAESBackends()) cout << backend.name << ", ";
+    cout << "справочная): " << (failures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // Справочный CFB - та же схема, что в encryptCFB с подробным выводом
+    mt19937 gen(2024);
+    int cfbFailures = 0;
+    for (int t = 0; t < 200; ++t) {
+        AESKey key(16 + 8 * (t % 3));
+        AES_IV iv;
+        for (auto& b : key) b = (uint8_t)gen();
+        for (auto& b : iv) b = (uint8_t)gen();
+        vector<uint8_t> plaintext(gen() % (t % 10 == 0 ? 5000 : 300)); // Иногда больше куска в 64 блока
+        for (auto& b : plaintext) b = (uint8_t)gen();
+
+        ExpandedAESKey expandedKey;
+        keyExpansion(expandedKey, key);
+        const int rounds = roundsForKeySize(key.size());
+        NoTrace noTrace;
+        const vector<uint8_t> expected = cfbReference(plaintext, key, iv, false, noTrace);
+        if (cfbReference(expected, key, iv, true, noTrace) != plaintext) ++cfbFailures;
+
+        // Трассировка не меняет результат, заполняет буфер ровно и последнее
+        // состояние каждого блока совпадает с потоком ключей
+        if (t % 20 == 0) {
+            const size_t blocks = (plaintext.size() + 15) / 16;
+            AESTrace trace(blocks, rounds);
+            bool traced = cfbReference(plaintext, key, iv, false, trace) == expected &&
+                          trace.size() == (size_t)rounds + 2 + blocks * AESTrace::recordsPerBlock(rounds);
+            for (size_t i = 0; traced && i < trace.size(); ++i)
+                if (trace[i].event == TraceEvent::Keystream && trace[i - 1].data != trace[i].data) traced = false;
+            if (!traced) {
+                cout << "CFB: трассировка расходится со справочным шифрованием" << endl;
+                ++cfbFailures;
+            }
+        }
+
+        const vector<uint8_t> ciphertext = encryptCFB(plaintext, key, iv, false);
+        if (ciphertext != expected || decryptCFB(ciphertext, key, iv, false) != plaintext) ++cfbFailures;
+        for (const AESBackend& backend : availableAESBackends()) {
+            AESKeySchedule schedule;
+            backend.expandKey(schedule, key);
+            vector<uint8_t> out(plaintext.size()), back(plaintext.size());
+            AESBlock encryptFeedback = iv, decryptFeedback = iv;
+            backend.cfbEncrypt(schedule, plaintext.data(), out.data(), plaintext.size(), encryptFeedback);
+            cfbDecryptBlocks(backend, schedule, out.data(), back.data(), out.size(), decryptFeedback);
+            // Потоки и дешифрование на месте дают тот же результат и ту же обратную связь
+            for (int threads = 2; threads <= 5; ++threads) {
+                vector<uint8_t> inPlace = out;
+                AESBlock parallelFeedback = iv;
+                cfbDecryptParallel(backend, schedule, inPlace.data(), inPlace.data(), inPlace.size(), parallelFeedback, threads);
+                if (inPlace != plaintext || (!out.empty() && parallelFeedback != decryptFeedback)) {
+                    cout << "CFB: расхождение параллельного дешифрования, потоков: " << threads << endl;
+                    ++cfbFailures;
+                }
+            }
+            // Шифрование блоками: те же ключевые потоки, что у справочного ядра
+            const size_t blocks = plaintext.size() / 16;
+            vector<uint8_t> ecb(16 * blocks), expectedEcb(16 * blocks);
+            backend.encryptBlocks(schedule, plaintext.data(), ecb.data(), blocks);
+            for (size_t b = 0; b < blocks; ++b) {
+                AESBlock block;
+                copy_n(plaintext.begin() + 16 * b, 16, block.begin());
+                AESState state = blockToState(block);
+                encryptBlock(state, expandedKey, rounds);
+                const AESBlock cipher = stateToBlock(state);
+                copy(cipher.begin(), cipher.end(), expectedEcb.begin() + 16 * b);
+            }
+            if (out != expected || back != plaintext || ecb != expectedEcb || encryptFeedback != decryptFeedback) {
+                cout << "CFB: расхождение в реализации " << backend.name << endl;
+                ++cfbFailures;
+            }
+        }
+    }
+    cout << "CFB (все реализации против справочной): " << (cfbFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // CTR: NIST SP 800-38A, F.5.1 (CTR-AES128.Encrypt), и совпадение по потокам
+    int ctrFailures = 0;
+    {
+        const AESKey key = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+        const AES_IV counter = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+        const vector<uint8_t> plaintext = {
+            0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+            0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+            0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+            0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+        const vector<uint8_t> expected = {
+            0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+            0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+            0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+            0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee};
+        if (encryptCTR(plaintext, key, counter) != expected || decryptCTR(expected, key, counter) != plaintext) ++ctrFailures;
+        for (const AESBackend& backend : availableAESBackends()) {
+            AESKeySchedule schedule;
+            backend.expandKey(schedule, key);
+            vector<uint8_t> data(5000 + gen() % 300);
+            for (auto& b : data) b = (uint8_t)gen();
+            vector<uint8_t> single(data.size());
+            ctrCryptParallel(backend, schedule, counter, data.data(), single.data(), data.size(), 1);
+            for (int threads = 2; threads <= 5; ++threads) {
+                vector<uint8_t> inPlace = data;
+                ctrCryptParallel(backend, schedule, counter, inPlace.data(), inPlace.data(), inPlace.size(), threads);
+                if (inPlace != single) {
+                    cout << "CTR: расхождение по потокам в реализации " << backend.name << ", потоков: " << threads << endl;
+                    ++ctrFailures;
+                }
+            }
+        }
+        // Перенос счетчика через все 128 бит
+        AESBlock all = {};
+        all.fill(0xff);
+        if (addToCounter(all, 1, false) != AESBlock{} || addToCounter(all, 1, true)[11] != 0xff) ++ctrFailures;
+    }
+    cout << "CTR (NIST SP 800-38A, потоки): " << (ctrFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // GCM: тестовые случаи 1, 2, 4 (AES-128), 7, 8 (AES-192) и 13, 14 (AES-256)
+    // из спецификации GCM (McGrew, Viega)
+    int gcmFailures = 0;
+    {
+        struct Case { string key, iv, aad, plain, cipher, tag; };
+        const Case cases[] = {
+            {"00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+             "58e2fccefa7e3061367f1d57a4e7455a"},
+            {"00000000000000000000000000000000", "000000000000000000000000", "", "00000000000000000000000000000000",
+             "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf"},
+            {"feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888", "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+             "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525"
+             "b16aedf5aa0de657ba637b39",
+             "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa05"
+             "1ba30b396a0aac973d58e091",
+             "5bc94fbc3221a5db94fae95ae7121a47"},
+            {"000000000000000000000000000000000000000000000000", "000000000000000000000000", "", "", "",
+             "cd33b28ac773f74ba00ed1f312572435"},
+            {"000000000000000000000000000000000000000000000000", "000000000000000000000000", "", "00000000000000000000000000000000",
+             "98e7247c07f0fe411c267e4384b0f600", "2ff58d80033927ab8ef4d4587514f0fb"},
+            {"0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000", "", "", "",
+             "530f8afbc74536b9a963b4f1c4cb738b"},
+            {"0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000", "",
+             "00000000000000000000000000000000", "cea7403d4d606b6e074ec5d3baf39d18", "d0d1c8a799996bf0265b98b5d48ab919"}};
+        for (const Case& c : cases) {
+            const AESKey key = parseHexBytes(c.key);
+            AESBlock tag;
+            const vector<uint8_t> iv = parseHexBytes(c.iv), aad = parseHexBytes(c.aad), plain = parseHexBytes(c.plain);
+            const vector<uint8_t> cipher = encryptGCM(plain, key, iv, aad, tag);
+            if (cipher != parseHexBytes(c.cipher) || tag != parseHexBlock(c.tag) || decryptGCM(cipher, key, iv, aad, tag) != plain) {
+                cout << "GCM: неверный результат на тестовом векторе с тегом " << c.tag << endl;
+                ++gcmFailures;
+            }
+        }
+
+        // Все реализации GHASH против умножения по определению
+        for (int t = 0; t < 50; ++t) {
+            AESKey key(16 + 8 * (t % 3));
+            for (auto& b : key) b = (uint8_t)gen();
+            AESKeySchedule schedule;
+            expandKeySchedule(schedule, key);
+            GHashKey hashKey;
+            makeGHashKey(hashKey, availableAESBackends().back(), schedule);
+            vector<uint8_t> data(gen() % 200);
+            for (auto& b : data) b = (uint8_t)gen();
+            AESBlock expected = {};
+            for (size_t i = 0; i < data.size(); i += 16) {
+                for (size_t j = 0; j < min<size_t>(16, data.size() - i); ++j) expected[j] ^= data[i + j];
+                expected = gf128Mul(expected, hashKey.powers[0]);
+            }
+            for (const GHashBackend& ghash : availableGHashBackends()) {
+                AESBlock x = {};
+                ghash.update(hashKey, x, data.data(), data.size());
+                if (x != expected) {
+                    cout << "GHASH: расхождение в реализации " << ghash.name << endl;
+                    ++gcmFailures;
+                }
+            }
+        }
+
+        // Потоки, неполный блок, IV не из 12 байт и шифрование на месте дают один тег
+        for (int t = 0; t < 20; ++t) {
+            AESKey key(16 + 8 * (t % 3));
+            for (auto& b : key) b = (uint8_t)gen();
+            vector<uint8_t> iv(t % 3 == 0 ? 1 + gen() % 40 : 12), aad(gen() % 50), data(gen() % 5000);
+            for (auto& b : iv) b = (uint8_t)gen();
+            for (auto& b : aad) b = (uint8_t)gen();
+            for (auto& b : data) b = (uint8_t)gen();
+            AESBlock tag;
+            const vector<uint8_t> cipher = encryptGCM(data, key, iv, aad, tag);
+            for (const AESBackend& backend : availableAESBackends()) {
+                AESKeySchedule schedule;
+                backend.expandKey(schedule, key);
+                for (const GHashBackend& ghash : availableGHashBackends())
+                    for (int threads = 1; threads <= 5; ++threads) {
+                        vector<uint8_t> inPlace = data;
+                        const AESBlock encryptTag = gcmCrypt(backend, ghash, schedule, iv.data(), iv.size(), aad.data(), aad.size(),
+                                                             inPlace.data(), inPlace.data(), inPlace.size(), true, threads);
+                        const bool encrypted = inPlace == cipher;
+                        const AESBlock decryptTag = gcmCrypt(backend, ghash, schedule, iv.data(), iv.size(), aad.data(), aad.size(),
+                                                             inPlace.data(), inPlace.data(), inPlace.size(), false, threads);
+                        if (!encrypted || inPlace != data || encryptTag != tag || decryptTag != tag) {
+                            cout << "GCM: расхождение в " << backend.name << " + " << ghash.name << ", потоков: " << threads << endl;
+                            ++gcmFailures;
+                        }
+                    }
+            }
+            // Измененный тег или шифротекст отвергаются
+            AESBlock badTag = tag;
+            badTag[gen() % 16] ^= 1;
+            vector<uint8_t> badCipher = cipher;
+            if (!badCipher.empty()) badCipher[gen() % badCipher.size()] ^= 0x80;
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                try {
+                    if (attempt == 0) decryptGCM(cipher, key, iv, aad, badTag);
+                    else if (!cipher.empty()) decryptGCM(badCipher, key, iv, aad, tag);
+                    else continue;
+                    cout << "GCM: поврежденные данные приняты" << endl;
+                    ++gcmFailures;
+                } catch (const runtime_error&) {
+                }
+            }
+        }
+    }
+    // Текст длиннее 2^32 - 2 блоков отвергается до обращения к данным
+    {
+        AESKeySchedule schedule;
+        expandKeySchedule(schedule, AESKey(16));
+        const uint8_t iv[12] = {};
+        bool rejected = false;
+        try {
+            gcmCrypt(activeAESBackend(), activeGHashBackend(), schedule, iv, 12, nullptr, 0, nullptr, nullptr,
+                     (size_t)(((1ULL << 32) - 2) * 16 + 1), true);
+        } catch (const invalid_argument&) {
+            rejected = true;
+        }
+        if (!rejected) {
+            cout << "GCM: данные длиннее 2^32 - 2 блоков приняты" << endl;
+            ++gcmFailures;
+        }
+    }
+    cout << "GCM (тестовые векторы, ";
+    for (const GHashBackend& ghash : availableGHashBackends()) cout << ghash.name << ", ";
+    cout << "потоки): " << (gcmFailures == 0 ? "OK" : "ОШИБКА") << endl;
+    // Потоковое шифрование файла совпадает с шифрованием целиком при любом
+    // размере куска, в том числе меньше файла и не кратном блоку; то же через mmap
+    int streamFailures = 0;
+    {
+        const string plainName = "check_stream_plain.bin", cipherName = "check_stream_cipher.bin", backName = "check_stream_back.bin",
+                     linkName = "check_stream_link.bin";
+        streambuf* coutBuffer = cout.rdbuf(nullptr); // Сообщения о файлах здесь не нужны
+        for (int t = 0; t < 12; ++t) {
+            AESKey key(16 + 8 * (t % 3));
+            AES_IV iv;
+            for (auto& b : key) b = (uint8_t)gen();
+            for (auto& b : iv) b = (uint8_t)gen();
+            vector<uint8_t> plaintext(t == 0 ? 0 : gen() % 3000);
+            for (auto& b : plaintext) b = (uint8_t)gen();
+            const AESMode mode = t % 2 == 0 ? AESMode::CFB : AESMode::CTR;
+            const size_t chunk = t % 3 == 0 ? 4 << 20 : 16 + gen() % 500;
+            writeToFile(plainName, plaintext);
+            cryptFileStream(plainName, cipherName, key, iv, mode, true, chunk);
+            cryptFileStream(cipherName, backName, key, iv, mode, false, chunk);
+            const vector<uint8_t> expected = mode == AESMode::CFB ? encryptCFB(plaintext, key, iv, false) : encryptCTR(plaintext, key, iv);
+            if (readFromFile(cipherName) != expected || readFromFile(backName) != plaintext) ++streamFailures;
+            // Через mmap: в новый файл и на месте
+            cryptFileMapped(plainName, cipherName, key, iv, mode, true);
+            if (readFromFile(cipherName) != expected) ++streamFailures;
+            cryptFileMapped(cipherName, "", key, iv, mode, false);
+            if (readFromFile(cipherName) != plaintext) ++streamFailures;
+            cryptFileMapped(plainName, plainName, key, iv, mode, true);
+            if (readFromFile(plainName) != expected) ++streamFailures;
+            // Поток с выходом, который другим путем указывает на вход: файл не
+            // обрезается, а шифруется на месте
+            cryptFileStream(plainName, "./" + plainName, key, iv, mode, false, chunk);
+            if (readFromFile(plainName) != plaintext) ++streamFailures;
+            // То же через mmap: символическая ссылка на вход - тоже шифрование на месте
+            remove(linkName.c_str());
+            if (symlink(plainName.c_str(), linkName.c_str()) != 0) ++streamFailures;
+            cryptFileMapped(plainName, linkName, key, iv, mode, true);
+            if (readFromFile(plainName) != expected) ++streamFailures;
+        }
+        cout.rdbuf(coutBuffer);
+        remove(plainName.c_str());
+        remove(cipherName.c_str());
+        remove(backName.c_str());
+        remove(linkName.c_str());
+    }
+    cout << "Шифрование файлов потоком и через mmap (CFB, CTR): " << (streamFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // Пакетный режим: несколько файлов с разными и повторяющимися ключами в
+    // пуле потоков, файл больше буфера потока, задание с выходом, который
+    // ведет во входной файл, и задание с отсутствующим файлом
+    int batchFailures = 0;
+    {
+        streambuf* coutBuffer = cout.rdbuf(nullptr);
+        const int files = 9;
+        vector<BatchJob> jobs, back;
+        vector<vector<uint8_t>> plaintexts;
+        const AESKey sharedKey(32, 7);
+        for (int f = 0; f < files; ++f) {
+            BatchJob job;
+            job.input = "check_batch_" + to_string(f) + ".in";
+            job.output = "check_batch_" + to_string(f) + ".out";
+            job.key = sharedKey;
+            if (f % 3 != 0) {
+                job.key.resize(16 + 8 * (f % 3));
+                for (auto& b : job.key) b = (uint8_t)gen();
+            }
+            for (auto& b : job.iv) b = (uint8_t)gen();
+            job.mode = f % 2 == 0 ? AESMode::CFB : AESMode::CTR;
+            plaintexts.emplace_back(f == 4 ? (1 << 20) * 2 + 5 : gen() % 2000);
+            for (auto& b : plaintexts.back()) b = (uint8_t)gen();
+            writeToFile(job.input, plaintexts.back());
+            jobs.push_back(job);
+            BatchJob reverse = job;
+            reverse.input = job.output;
+            reverse.output = job.input + ".back";
+            back.push_back(reverse);
+        }
+        BatchJob aliased = jobs[0];
+        aliased.input = "check_batch_alias.in";
+        aliased.output = "./" + aliased.input;
+        const vector<uint8_t> aliasedData(3000, 0x5a);
+        writeToFile(aliased.input, aliasedData);
+        jobs.push_back(aliased);
+        BatchJob missing = jobs[0];
+        missing.input = "check_batch_missing.in";
+        missing.output = "check_batch_missing.out";
+        jobs.push_back(missing);
+        const vector<BatchResult> encrypted = runBatchJobs(jobs, true, 3);
+        const vector<BatchResult> decrypted = runBatchJobs(back, false, 2);
+        for (int f = 0; f < files; ++f) {
+            const BatchJob& job = jobs[f];
+            const vector<uint8_t> expected = job.mode == AESMode::CFB ? encryptCFB(plaintexts[f], job.key, job.iv, false)
+                                                                      : encryptCTR(plaintexts[f], job.key, job.iv);
+            if (!encrypted[f].error.empty() || !decrypted[f].error.empty() || encrypted[f].bytes != plaintexts[f].size() ||
+                readFromFile(job.output) != expected || readFromFile(back[f].output) != plaintexts[f])
+                ++batchFailures;
+            remove(job.input.c_str());
+            remove(job.output.c_str());
+            remove(back[f].output.c_str());
+        }
+        if (encrypted.back().error.empty()) ++batchFailures;
+        if (encrypted[files].error.empty() || readFromFile(aliased.input) != aliasedData) ++batchFailures;
+        remove(aliased.input.c_str());
+        remove(missing.output.c_str());
+        cout.rdbuf(coutBuffer);
+    }
+    cout << "Пакетный режим (пул потоков, разные ключи): " << (batchFailures == 0 ? "OK" : "ОШИБКА") << endl;
+
+    // Кеш расширенных ключей: повторный ключ не расширяется заново, вытесняется
+    // давно не использованный, вытесненное расписание живо у держателя, а
+    // потоки с общим набором ключей получают верные расписания
+    int cacheFailures = 0;
+    {
+        KeyScheduleCache cache(2);
+        const AESKey a(16, 1), b(24, 2), c(32, 3);
+        const auto first = cache.get(a), second = cache.get(b);
+        if (cache.get(a) != first || cache.misses() != 2 || cache.hits() != 1) ++cacheFailures;
+        cache.get(c); // Вытесняет b: a недавно использован
+        if (cache.get(a) != first || cache.get(b) == second || cache.misses() != 4) ++cacheFailures;
+        AESKeySchedule expected;
+        expandKeySchedule(expected, b);
+        if (second->rounds != 12 || second->bytes != expected.bytes) ++cacheFailures;
+
+        KeyScheduleCache shared(3);
+        vector<AESKey> keys;
+        vector<AESKeySchedule> schedules(5);
+        for (int k = 0; k < 5; ++k) {
+            keys.emplace_back(16 + 8 * (k % 3));
+            for (auto& byte : keys.back()) byte = (uint8_t)gen();
+            expandKeySchedule(schedules[k], keys[k]);
+        }
+        atomic<int> wrong(0);
+        vector<thread> workers;
+        for (int t = 0; t < 4; ++t)
+            workers.emplace_back([&, t] {
+                for (int i = 0; i < 2000; ++i) {
+                    const int k = (i * 7 + t) % 5;
+                    const auto schedule = shared.get(keys[k]);
+                    if (schedule->rounds != schedules[k].rounds || schedule->words != schedules[k].words) ++wrong;
+                }
+            });
+        for (thread& w : workers) w.join();
+        if (wrong != 0 || shared.hits() + shared.misses() != 8000) ++cacheFailures;
+
+        bool rejected = false;
+        try {
+            AESContext(AESKey(20));
+        } catch (const invalid_argument&) {
+            rejected = true;
+        }
+        if (!rejected) ++cacheFailures;
+    }
+    cout << "Кеш расширенных ключей (LRU, потоки): " << (cacheFailures == 0 ? "OK" : "ОШИБКА") << endl;
+    return failures == 0 && cfbFailures == 0 && ctrFailures == 0 && gcmFailures == 0 && streamFailures == 0 && batchFailures == 0 &&
+           cacheFailures == 0;
+}
+
+// Замер реализаций: расширение ключа, шифрование независимых блоков, CFB,
+// CTR, GCM и GHASH.
+// ./task2 --bench [--size МБ]
+int runAESBenchmark(int argc, char* argv[]) {
+    size_t megabytes = 256;
+    for (int i = 2; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) megabytes = stoull(argv[++i]);
+        else throw invalid_argument("Неизвестный аргумент: " + arg);
+    }
+    if (megabytes == 0) throw invalid_argument("Размер данных должен быть больше нуля");
+    const size_t size = megabytes << 20;
+    vector<uint8_t> data(size), out(size);
+    mt19937 gen(1);
+    for (auto& b : data) b = (uint8_t)gen();
+    const AESKey key = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    const AES_IV iv = {};
+
+    auto seconds = [](auto&& body) {
+        const auto start = chrono::steady_clock::now();
+        body();
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    cout << fixed << setprecision(3);
+    for (const AESBackend& backend : availableAESBackends()) {
+        AESKeySchedule schedule;
+        const int expansions = 100000;
+        const double expandTime = seconds([&] {
+            for (int i = 0; i < expansions; ++i) backend.expandKey(schedule, key);
+        });
+        const double blocksTime = seconds([&] { backend.encryptBlocks(schedule, data.data(), out.data(), size / 16); });
+        AESBlock feedback = iv;
+        const double encryptTime = seconds([&] { backend.cfbEncrypt(schedule, data.data(), out.data(), size, feedback); });
+        feedback = iv;
+        const double decryptTime = seconds([&] { cfbDecryptBlocks(backend, schedule, out.data(), data.data(), size, feedback); });
+        feedback = iv;
+        const double parallelTime = seconds([&] { cfbDecryptParallel(backend, schedule, out.data(), data.data(), size, feedback); });
+        cout << backend.name << ":\n";
+        cout << "  Расширение ключа: " << expandTime / expansions * 1e9 << " нс\n";
+        cout << "  Независимые блоки: " << size / blocksTime / 1e9 << " ГБ/с\n";
+        cout << "  CFB шифрование: " << size / encryptTime / 1e9 << " ГБ/с\n";
+        cout << "  CFB дешифрование: " << size / decryptTime / 1e9 << " ГБ/с\n";
+        const double ctrTime = seconds([&] { ctrCryptParallel(backend, schedule, iv, data.data(), out.data(), size); });
+        const double gcmTime = seconds([&] {
+            gcmCrypt(backend, activeGHashBackend(), schedule, iv.data(), 12, nullptr, 0, data.data(), out.data(), size, true);
+        });
+        cout << "  CFB дешифрование по потокам (ядер: " << thread::hardware_concurrency() << "): " << size / parallelTime / 1e9 << " ГБ/с\n";
+        cout << "  CTR по потокам: " << size / ctrTime / 1e9 << " ГБ/с\n";
+        cout << "  GCM по потокам (GHASH: " << activeGHashBackend().name << "): " << size / gcmTime / 1e9 << " ГБ/с\n";
+    }
+    // GHASH отдельно: каждая реализация на тех же данных
+    AESKeySchedule schedule;
+    expandKeySchedule(schedule, key);
+    GHashKey hashKey;
+    makeGHashKey(hashKey, availableAESBackends().back(), schedule);
+    for (const GHashBackend& ghash : availableGHashBackends()) {
+        AESBlock x = {};
+        const double ghashTime = seconds([&] { ghash.update(hashKey, x, data.data(), size); });
+        cout << "GHASH " << ghash.name << ": " << size / ghashTime / 1e9 << " ГБ/с\n";
+    }
+    return 0;
+}
+
+// Счетчик тактов: на x86 - TSC. Он идет с опорной частотой процессора, а не
+// с текущей частотой ядра, зато одинаково во всех замерах
+uint64_t readCycleCounter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Задержка операции по выборкам: прогрев, затем вызовы по одному, пока не
+// наберется 10000 выборок или 0.2 с (но не меньше 5 выборок). Из каждой
+// выборки вычитается стоимость пустого замера, иначе у 16-байтных сообщений
+// таймер съел бы большую часть результата.
+template <class Body>
+BenchStats measureLatency(Body&& body, double overhead, uint64_t cycleOverhead) {
+    const size_t minSamples = 5, maxSamples = 10000;
+    const double budget = 0.2;
+    body();
+    vector<double> times;
+    vector<uint64_t> cycles;
+    const auto start = chrono::steady_clock::now();
+    while (times.size() < maxSamples &&
+           (times.size() < minSamples || chrono::duration<double>(chrono::steady_clock::now() - start).count() < budget)) {
+        const auto t0 = chrono::steady_clock::now();
+        const uint64_t c0 = readCycleCounter();
+        body();
+        const uint64_t c1 = readCycleCounter();
+        const auto t1 = chrono::steady_clock::now();
+        times.push_back(max(0.0, chrono::duration<double, nano>(t1 - t0).count() - overhead));
+        cycles.push_back(c1 - c0 > cycleOverhead ? c1 - c0 - cycleOverhead : 0);
+    }
+    sort(times.begin(), times.end());
+    sort(cycles.begin(), cycles.end());
+    auto percentile = [&](double p) { return times[(size_t)(p * (times.size() - 1))]; };
+    BenchStats stats;
+    stats.samples = times.size();
+    stats.p50 = percentile(0.5);
+    stats.p90 = percentile(0.9);
+    stats.p99 = percentile(0.99);
+    stats.max = times.back();
+    stats.cycles = (double)cycles[cycles.size() / 2];
+    return stats;
+}
+
+// Набор замеров для отслеживания регрессий: расширение ключа, шифрование
+// одного блока и CFB в обе стороны на сообщениях от 16 байт до --max-size
+// (по умолчанию 1 ГБ, размеры растут в 4 раза) для каждой реализации и для
+// справочного кода. Справочный CFB (cfbReference, с расширением ключа на
+// каждый вызов) медленный, поэтому меряется только до 4 МБ. Результат - JSON.
+// ./task2 --bench-suite [--out aes_bench.json] [--max-size МБ] [--key-bits 128|192|256]
+int runAESBenchmarkSuite(int argc, char* argv[]) {
+    string outPath = "aes_bench.json";
+    size_t maxMegabytes = 1024;
+    int keyBits = 128;
+    for (int i = 2; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc) outPath = argv[++i];
+        else if (arg == "--max-size" && i + 1 < argc) maxMegabytes = stoull(argv[++i]);
+        else if (arg == "--key-bits" && i + 1 < argc) keyBits = stoi(argv[++i]);
+        else throw invalid_argument("Неизвестный аргумент: " + arg);
+    }
+    if (maxMegabytes == 0) throw invalid_argument("Размер данных должен быть больше нуля");
+    AESKey key(keyBits / 8);
+    roundsForKeySize(key.size()); // Отклоняет длину, отличную от 128/192/256 бит
+    const size_t maxSize = maxMegabytes << 20, referenceLimit = size_t(4) << 20;
+    vector<size_t> sizes;
+    for (size_t size = 16; size <= maxSize; size *= 4) sizes.push_back(size);
+
+    mt19937 gen(1);
+    for (auto& b : key) b = (uint8_t)gen();
+    const AES_IV iv = {};
+    vector<uint8_t> data(sizes.back()), out(sizes.back());
+    for (auto& b : data) b = (uint8_t)gen();
+
+    // Стоимость самого замера: пустое тело
+    const BenchStats empty = measureLatency([] {}, 0, 0);
+    const uint64_t cycleOverhead = (uint64_t)empty.cycles;
+    // Такты TSC на наносекунду, чтобы сравнивать с частотой процессора
+    const auto calibrationStart = chrono::steady_clock::now();
+    const uint64_t calibrationCycles = readCycleCounter();
+    this_thread::sleep_for(chrono::milliseconds(100));
+    const double cyclesPerNs = (readCycleCounter() - calibrationCycles) /
+                               chrono::duration<double, nano>(chrono::steady_clock::now() - calibrationStart).count();
+
+    ofstream json(outPath);
+    if (!json) throw runtime_error("Не удалось открыть файл " + outPath);
+    json << fixed << setprecision(3);
+    json << "{\n  \"key_bits\": " << keyBits << ",\n  \"hardware_threads\": " << thread::hardware_concurrency()
+         << ",\n  \"cycle_counter\": \"" << (cyclesPerNs > 0 ? "rdtsc" : "none") << "\",\n  \"tsc_ghz\": " << cyclesPerNs
+         << ",\n  \"timer_overhead_ns\": " << empty.p50 << ",\n  \"results\": [";
+    bool first = true;
+    auto record = [&](const string& implementation, const string& operation, size_t bytes, auto&& body) {
+        const BenchStats stats = measureLatency(body, empty.p50, cycleOverhead);
+        const double gbPerSecond = stats.p50 > 0 ? bytes / stats.p50 : 0;
+        json << (first ? "\n" : ",\n") << "    {\"implementation\": \"" << implementation << "\", \"operation\": \"" << operation
+             << "\", \"bytes\": " << bytes << ", \"samples\": " << stats.samples << ", \"gb_per_s\": " << gbPerSecond
+             << ", \"cycles_per_byte\": ";
+        if (cyclesPerNs > 0) json << stats.cycles / bytes;
+        else json << "null";
+        json << ", \"latency_ns\": {\"p50\": " << stats.p50 << ", \"p90\": " << stats.p90 << ", \"p99\": " << stats.p99
+             << ", \"max\": " << stats.max << "}}";
+        first = false;
+        cout << implementation << " " << operation << " " << bytes << " Б: " << gbPerSecond << " ГБ/с, p50 " << stats.p50
+             << " нс" << endl;
+    };
+
+    cout << fixed << setprecision(3);
+    {
+        ExpandedAESKey expandedKey;
+        const int rounds = roundsForKeySize(key.size());
+        record("справочная", "key_expansion", key.size(), [&] { keyExpansion(expandedKey, key); });
+        record("справочная", "encrypt_block", 16, [&] {
+            AESBlock block;
+            copy_n(data.begin(), 16, block.begin());
+            AESState state = blockToState(block);
+            encryptBlock(state, expandedKey, rounds);
+            const AESBlock cipher = stateToBlock(state);
+            copy(cipher.begin(), cipher.end(), out.begin());
+        });
+        for (const size_t size : sizes) {
+            if (size > referenceLimit) break;
+            const vector<uint8_t> message(data.begin(), data.begin() + size);
+            NoTrace noTrace;
+            vector<uint8_t> cipher, plain;
+            record("справочная", "cfb_encrypt", size, [&] { cipher = cfbReference(message, key, iv, false, noTrace); });
+            record("справочная", "cfb_decrypt", size, [&] { plain = cfbReference(cipher, key, iv, true, noTrace); });
+        }
+        secureWipe(expandedKey.data(), expandedKey.size());
+    }
+    for (const AESBackend& backend : availableAESBackends()) {
+        AESKeySchedule schedule;
+        record(backend.name, "key_expansion", key.size(), [&] { backend.expandKey(schedule, key); });
+        record(backend.name, "encrypt_block", 16, [&] { backend.encryptBlocks(schedule, data.data(), out.data(), 1); });
+        for (const size_t size : sizes) {
+            AESBlock feedback = iv;
+            record(backend.name, "cfb_encrypt", size, [&] {
+                feedback = iv;
+                backend.cfbEncrypt(schedule, data.data(), out.data(), size, feedback);
+            });
+            record(backend.name, "cfb_decrypt", size, [&] {
+                feedback = iv;
+                cfbDecryptBlocks(backend, schedule, out.data(), data.data(), size, feedback);
+            });
+        }
+    }
+    json << "\n  ]\n}\n";
+    if (!json) throw runtime_error("Не удалось записать файл " + outPath);
+    cout << "Результаты записаны в " << outPath << endl;
+    return 0;
+}
+
+// Пакетное шифрование по манифесту с отчетом о пропускной способности и
+// задержке заданий.
+// ./task2 --batch manifest.txt [--decrypt] [--threads N]
+int runAESBatch(int argc, char* argv[]) {
+    string manifest;
+    bool encrypt = true;
+    int threads = 0;
+    for (int i = 2; i < argc; ++i) {
+        const string arg = argv[i];
+        if (arg == "--decrypt") encrypt = false;
+        else if (arg == "--threads" && i + 1 < argc) threads = stoi(argv[++i]);
+        else if (manifest.empty() && arg.rfind("--", 0) != 0) manifest = arg;
+        else throw invalid_argument("Неизвестный аргумент: " + arg);
+    }
+    if (manifest.empty()) throw invalid_argument("Не задан файл манифеста");
+    const vector<BatchJob> jobs = readBatchManifest(manifest);
+    if (jobs.empty()) throw invalid_argument("Манифест не содержит заданий: " + manifest);
+
+    const auto start = chrono::steady_clock::now();
+    const vector<BatchResult> results = runBatchJobs(jobs, encrypt, threads);
+    const double wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t bytes = 0;
+    vector<double> latencies;
+    int failed = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (!results[i].error.empty()) {
+            cerr << jobs[i].input << ": " << results[i].error << endl;
+            ++failed;
+            continue;
+        }
+        bytes += results[i].bytes;
+        latencies.push_back(results[i].seconds);
+    }
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies.empty() ? 0.0 : latencies[(size_t)(p * (latencies.size() - 1))] * 1e6; };
+    cout << fixed << setprecision(3);
+    cout << "Заданий: " << jobs.size() - failed << " из " << jobs.size() << ", " << bytes << " байт за " << wall << " с\n";
+    cout << "Пропускная способность: " << bytes / wall / 1e6 << " МБ/с, " << (jobs.size() - failed) / wall << " файлов/с\n";
+    cout << "Задержка задания, мкс: p50 " << percentile(0.5) << ", p90 " << percentile(0.9) << ", p99 " << percentile(0.99)
+         << ", макс. " << percentile(1.0) << "\n";
+    return failed == 0 ? 0 : 1;
+}